@@ -3,27 +3,249 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
-int atomic_increment(int* address)
+// Loads and stores map to the Read*/Write* helpers, which are plain moves plus a compiler
+// barrier on x86/x64 and use the load-acquire/store-release instructions on ARM.
+// Read-modify-writes map to the Interlocked*Acquire/Release/NoFence families,
+// which only drop the full fence on architectures that have weaker instructions.
+// A seq_cst load is an acquire load: every seq_cst store below is a full-fence exchange.
+
+int atomic_increment(volatile int* address)
+{
+	return InterlockedIncrement((volatile LONG*)address) - 1;
+}
+
+int atomic_decrement(volatile int* address)
+{
+	return InterlockedDecrement((volatile LONG*)address) + 1;
+}
+
+int atomic_compare_and_exchange(volatile int* dest, int compare, int exchange)
+{
+	return InterlockedCompareExchange((volatile LONG*)dest, exchange, compare);
+}
+
+int atomic_load(volatile int* address)
+{
+	return atomic_load32(address, k_atomic_acquire);
+}
+
+void atomic_store(volatile int* address, int value)
+{
+	atomic_store32(address, value, k_atomic_release);
+}
+
+int atomic_load32(volatile int* address, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return ReadNoFence((volatile LONG*)address);
+	default:
+		return ReadAcquire((volatile LONG*)address);
+	}
+}
+
+void atomic_store32(volatile int* address, int value, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		WriteNoFence((volatile LONG*)address, value);
+		break;
+	case k_atomic_release:
+		WriteRelease((volatile LONG*)address, value);
+		break;
+	default:
+		InterlockedExchange((volatile LONG*)address, value);
+		break;
+	}
+}
+
+int atomic_fetch_add32(volatile int* address, int value, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return InterlockedExchangeAddNoFence((volatile LONG*)address, value);
+	case k_atomic_acquire:
+		return InterlockedExchangeAddAcquire((volatile LONG*)address, value);
+	case k_atomic_release:
+		return InterlockedExchangeAddRelease((volatile LONG*)address, value);
+	default:
+		return InterlockedExchangeAdd((volatile LONG*)address, value);
+	}
+}
+
+int atomic_exchange32(volatile int* address, int value, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return InterlockedExchangeNoFence((volatile LONG*)address, value);
+	case k_atomic_acquire:
+		return InterlockedExchangeAcquire((volatile LONG*)address, value);
+	default:
+		return InterlockedExchange((volatile LONG*)address, value);
+	}
+}
+
+int atomic_compare_exchange32(volatile int* address, int compare, int exchange, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return InterlockedCompareExchangeNoFence((volatile LONG*)address, exchange, compare);
+	case k_atomic_acquire:
+		return InterlockedCompareExchangeAcquire((volatile LONG*)address, exchange, compare);
+	case k_atomic_release:
+		return InterlockedCompareExchangeRelease((volatile LONG*)address, exchange, compare);
+	default:
+		return InterlockedCompareExchange((volatile LONG*)address, exchange, compare);
+	}
+}
+
+int64_t atomic_load64(volatile int64_t* address, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return ReadNoFence64((volatile LONG64*)address);
+	default:
+		return ReadAcquire64((volatile LONG64*)address);
+	}
+}
+
+void atomic_store64(volatile int64_t* address, int64_t value, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		WriteNoFence64((volatile LONG64*)address, value);
+		break;
+	case k_atomic_release:
+		WriteRelease64((volatile LONG64*)address, value);
+		break;
+	default:
+		InterlockedExchange64((volatile LONG64*)address, value);
+		break;
+	}
+}
+
+int64_t atomic_fetch_add64(volatile int64_t* address, int64_t value, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return InterlockedExchangeAddNoFence64((volatile LONG64*)address, value);
+	case k_atomic_acquire:
+		return InterlockedExchangeAddAcquire64((volatile LONG64*)address, value);
+	case k_atomic_release:
+		return InterlockedExchangeAddRelease64((volatile LONG64*)address, value);
+	default:
+		return InterlockedExchangeAdd64((volatile LONG64*)address, value);
+	}
+}
+
+int64_t atomic_exchange64(volatile int64_t* address, int64_t value, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return InterlockedExchangeNoFence64((volatile LONG64*)address, value);
+	case k_atomic_acquire:
+		return InterlockedExchangeAcquire64((volatile LONG64*)address, value);
+	default:
+		return InterlockedExchange64((volatile LONG64*)address, value);
+	}
+}
+
+int64_t atomic_compare_exchange64(volatile int64_t* address, int64_t compare, int64_t exchange, atomic_order_t order)
+{
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return InterlockedCompareExchangeNoFence64((volatile LONG64*)address, exchange, compare);
+	case k_atomic_acquire:
+		return InterlockedCompareExchangeAcquire64((volatile LONG64*)address, exchange, compare);
+	case k_atomic_release:
+		return InterlockedCompareExchangeRelease64((volatile LONG64*)address, exchange, compare);
+	default:
+		return InterlockedCompareExchange64((volatile LONG64*)address, exchange, compare);
+	}
+}
+
+void* atomic_load_ptr(void* volatile* address, atomic_order_t order)
 {
-	return InterlockedIncrement(address) - 1;
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return ReadPointerNoFence(address);
+	default:
+		return ReadPointerAcquire(address);
+	}
 }
 
-int atomic_decrement(int* address)
+void atomic_store_ptr(void* volatile* address, void* value, atomic_order_t order)
 {
-	return InterlockedDecrement(address) + 1;
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		WritePointerNoFence(address, value);
+		break;
+	case k_atomic_release:
+		WritePointerRelease(address, value);
+		break;
+	default:
+		InterlockedExchangePointer(address, value);
+		break;
+	}
 }
 
-int atomic_compare_and_exchange(int* dest, int compare, int exchange)
+void* atomic_exchange_ptr(void* volatile* address, void* value, atomic_order_t order)
 {
-	return InterlockedCompareExchange(dest, exchange, compare);
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return InterlockedExchangePointerNoFence(address, value);
+	case k_atomic_acquire:
+		return InterlockedExchangePointerAcquire(address, value);
+	default:
+		return InterlockedExchangePointer(address, value);
+	}
 }
 
-int atomic_load(int* address)
+void* atomic_compare_exchange_ptr(void* volatile* address, void* compare, void* exchange, atomic_order_t order)
 {
-	return *(volatile int*)address;
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		return InterlockedCompareExchangePointerNoFence(address, exchange, compare);
+	case k_atomic_acquire:
+		return InterlockedCompareExchangePointerAcquire(address, exchange, compare);
+	case k_atomic_release:
+		return InterlockedCompareExchangePointerRelease(address, exchange, compare);
+	default:
+		return InterlockedCompareExchangePointer(address, exchange, compare);
+	}
 }
 
-void atomic_store(int* address, int value)
+void atomic_fence(atomic_order_t order)
 {
-	*(volatile int*)address = value;
+	switch (order)
+	{
+	case k_atomic_relaxed:
+		break;
+	case k_atomic_seq_cst:
+		MemoryBarrier();
+		break;
+	default:
+#if defined(_M_ARM) || defined(_M_ARM64)
+		MemoryBarrier();
+#else
+		// x86 and x64 only ever move loads ahead of earlier stores,
+		// which acquire and release fences permit; stop the compiler reordering.
+		_ReadWriteBarrier();
+#endif
+		break;
+	}
 }
@@ -1,29 +1,93 @@
 #pragma once
 
-// Atomic operations on 32-bit integers.
+#include <stdint.h>
+
+// Atomic operations on 32-bit integers, 64-bit integers and pointers.
+//
+// The explicit-order variants take a memory order, which follows C11:
+//   relaxed: atomicity only, no ordering of surrounding memory accesses.
+//   acquire: later accesses cannot move before this one. For loads and read-modify-writes.
+//   release: earlier accesses cannot move after this one. For stores and read-modify-writes.
+//   seq_cst: acquire and release, and all seq_cst operations appear in a single total order.
+// An order that does not apply to an operation (acquire on a store, say) is treated as seq_cst.
+// Pass a constant order; release builds inline these and the choice compiles away.
+
+typedef enum atomic_order_t
+{
+	k_atomic_relaxed,
+	k_atomic_acquire,
+	k_atomic_release,
+	k_atomic_seq_cst,
+} atomic_order_t;
 
 // Increment a number atomically.
 // Returns the old value of the number.
 // Performs the following operation atomically:
 //   int old_value = *address; (*address)++; return old_value;
-int atomic_increment(int* address);
+int atomic_increment(volatile int* address);
 
 // Decrement a number atomically.
 // Returns the old value of the number.
 // Performs the following operation atomically:
 //   int old_value = *address; (*address)--; return old_value;
-int atomic_decrement(int* address);
+int atomic_decrement(volatile int* address);
 
 // Compare two numbers atomically and assign if equal.
 // Returns the old value of the number.
 // Performs the following operation atomically:
 //   int old_value = *address; if (*address == compare) *address = exchange; return old_value;
-int atomic_compare_and_exchange(int* dest, int compare, int exchange);
+int atomic_compare_and_exchange(volatile int* dest, int compare, int exchange);
 
-// Reads an integer from an address.
-// All writes that occurred before the last atomic_store to this address are flushed.
-int atomic_load(int* address);
+// Reads an integer from an address with acquire ordering.
+// All writes that occurred before the last atomic_store to this address are visible.
+int atomic_load(volatile int* address);
 
-// Writes an integer.
+// Writes an integer with release ordering.
 // Paired with an atomic_load, can guarantee ordering and visibility.
-void atomic_store(int* address, int value);
+void atomic_store(volatile int* address, int value);
+
+// Read a 32-bit integer.
+int atomic_load32(volatile int* address, atomic_order_t order);
+
+// Write a 32-bit integer.
+void atomic_store32(volatile int* address, int value, atomic_order_t order);
+
+// Add to a 32-bit integer. Returns the old value.
+int atomic_fetch_add32(volatile int* address, int value, atomic_order_t order);
+
+// Replace a 32-bit integer. Returns the old value.
+int atomic_exchange32(volatile int* address, int value, atomic_order_t order);
+
+// Replace a 32-bit integer with exchange if it is equal to compare. Returns the old value.
+int atomic_compare_exchange32(volatile int* address, int compare, int exchange, atomic_order_t order);
+
+// Read a 64-bit integer.
+int64_t atomic_load64(volatile int64_t* address, atomic_order_t order);
+
+// Write a 64-bit integer.
+void atomic_store64(volatile int64_t* address, int64_t value, atomic_order_t order);
+
+// Add to a 64-bit integer. Returns the old value.
+int64_t atomic_fetch_add64(volatile int64_t* address, int64_t value, atomic_order_t order);
+
+// Replace a 64-bit integer. Returns the old value.
+int64_t atomic_exchange64(volatile int64_t* address, int64_t value, atomic_order_t order);
+
+// Replace a 64-bit integer with exchange if it is equal to compare. Returns the old value.
+int64_t atomic_compare_exchange64(volatile int64_t* address, int64_t compare, int64_t exchange, atomic_order_t order);
+
+// Read a pointer.
+void* atomic_load_ptr(void* volatile* address, atomic_order_t order);
+
+// Write a pointer.
+void atomic_store_ptr(void* volatile* address, void* value, atomic_order_t order);
+
+// Replace a pointer. Returns the old value.
+void* atomic_exchange_ptr(void* volatile* address, void* value, atomic_order_t order);
+
+// Replace a pointer with exchange if it is equal to compare. Returns the old value.
+void* atomic_compare_exchange_ptr(void* volatile* address, void* compare, void* exchange, atomic_order_t order);
+
+// Order memory accesses around this point without touching memory.
+// A relaxed fence does nothing.
+void atomic_fence(atomic_order_t order);
@@ -0,0 +1,43 @@
+#include "debug.h"
+#include "heap_bench.h"
+#include "job_bench.h"
+#include "sync_bench.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Benchmark entry point.
+// Usage: ga2022_bench [heap|sync|job] [max_threads]
+// With no arguments every benchmark is run up to the number of logical processors.
+int main(int argc, const char* argv[])
+{
+	debug_set_print_mask(k_print_info | k_print_warning | k_print_error);
+
+	timer_startup();
+
+	int max_threads = thread_get_logical_core_count();
+	if (argc > 2)
+	{
+		max_threads = atoi(argv[2]);
+	}
+
+	const char* suite = argc > 1 ? argv[1] : "all";
+	bool all = strcmp(suite, "all") == 0;
+	if (all || strcmp(suite, "heap") == 0)
+	{
+		heap_bench_run(max_threads);
+	}
+	if (all || strcmp(suite, "sync") == 0)
+	{
+		sync_bench_run(max_threads);
+	}
+	if (all || strcmp(suite, "job") == 0)
+	{
+		job_bench_run(max_threads);
+	}
+
+	return 0;
+}
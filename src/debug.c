@@ -1,6 +1,7 @@
 #include "debug.h"
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #define WIN32_LEAN_AND_MEAN
@@ -8,6 +9,7 @@
 #include <DbgHelp.h>
 
 static uint32_t s_mask = 0xffffffff;
+static bool s_symbols_initialized = false;
 
 static LONG debug_exception_handler(LPEXCEPTION_POINTERS info)
 {
@@ -78,3 +80,36 @@ int debug_backtrace(void** stack, int stack_capacity)
 {
 	return CaptureStackBackTrace(1, stack_capacity, stack, NULL);
 }
+
+void debug_symbolicate(void* address, char* buffer, size_t buffer_size)
+{
+	HANDLE process = GetCurrentProcess();
+	if (!s_symbols_initialized)
+	{
+		SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES);
+		s_symbols_initialized = SymInitialize(process, NULL, TRUE);
+	}
+
+	uint64_t symbol_buffer[(sizeof(SYMBOL_INFO) + MAX_SYM_NAME + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+	SYMBOL_INFO* symbol = (SYMBOL_INFO*)symbol_buffer;
+	symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+	symbol->MaxNameLen = MAX_SYM_NAME;
+
+	DWORD64 displacement = 0;
+	if (!s_symbols_initialized || !SymFromAddr(process, (DWORD64)address, &displacement, symbol))
+	{
+		snprintf(buffer, buffer_size, "%p", address);
+		return;
+	}
+
+	IMAGEHLP_LINE64 line = { .SizeOfStruct = sizeof(IMAGEHLP_LINE64) };
+	DWORD line_displacement = 0;
+	if (SymGetLineFromAddr64(process, (DWORD64)address, &line_displacement, &line))
+	{
+		snprintf(buffer, buffer_size, "%s (%s:%lu)", symbol->Name, line.FileName, line.LineNumber);
+	}
+	else
+	{
+		snprintf(buffer, buffer_size, "%s+0x%llx", symbol->Name, displacement);
+	}
+}
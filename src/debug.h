@@ -29,3 +29,8 @@ void debug_print(uint32_t type, _Printf_format_string_ const char* format, ...);
 // On return, stack contains at most stack_capacity addresses.
 // The number of addresses captured is the return value.
 int debug_backtrace(void** stack, int stack_capacity);
+
+// Describe a code address, such as one captured by debug_backtrace, as text.
+// Writes the function name and source line when symbols are available,
+// otherwise the raw address.
+void debug_symbolicate(void* address, char* buffer, size_t buffer_size);
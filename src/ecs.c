@@ -23,6 +23,7 @@ typedef struct ecs_t
 {
 	heap_t* heap;
 	int global_sequence;
+	int entity_count;
 
 	int sequences[k_max_entities];
 	entity_state_t entity_states[k_max_entities];
@@ -67,6 +68,20 @@ void ecs_update(ecs_t* ecs)
 			ecs->entity_states[i] = k_entity_unused;
 		}
 	}
+
+	ecs->entity_count = 0;
+	for (int i = 0; i < _countof(ecs->entity_states); ++i)
+	{
+		if (ecs->entity_states[i] == k_entity_active)
+		{
+			ecs->entity_count++;
+		}
+	}
+}
+
+int ecs_get_entity_count(ecs_t* ecs)
+{
+	return ecs->entity_count;
 }
 
 int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment)
@@ -34,6 +34,9 @@ void ecs_destroy(ecs_t* ecs);
 // Per-frame entity component system update.
 void ecs_update(ecs_t* ecs);
 
+// Get the number of active entities as of the last update.
+int ecs_get_entity_count(ecs_t* ecs);
+
 // Register a type of component with the entity system.
 int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment);
 
@@ -1,11 +1,18 @@
 #include "event.h"
 
+#include "debug.h"
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
 event_t* event_create()
 {
-	HANDLE evt = CreateEvent(NULL, TRUE, FALSE, NULL);
+	return event_create_ex(false);
+}
+
+event_t* event_create_ex(bool auto_reset)
+{
+	HANDLE evt = CreateEvent(NULL, auto_reset ? FALSE : TRUE, FALSE, NULL);
 	return (event_t*)evt;
 }
 
@@ -19,11 +26,61 @@ void event_signal(event_t* event)
 	SetEvent(event);
 }
 
+void event_reset(event_t* event)
+{
+	ResetEvent(event);
+}
+
 void event_wait(event_t* event)
 {
 	WaitForSingleObject(event, INFINITE);
 }
 
+bool event_wait_timeout(event_t* event, uint32_t timeout_ms)
+{
+	return WaitForSingleObject(event, timeout_ms) == WAIT_OBJECT_0;
+}
+
+int event_wait_any(event_t** events, int count, uint32_t timeout_ms)
+{
+	if (count <= 0 || count > EVENT_WAIT_ANY_MAX)
+	{
+		debug_print(k_print_error, "Cannot wait on %d events at once!\n", count);
+		return -1;
+	}
+
+	DWORD result = WaitForMultipleObjects(count, (HANDLE*)events, FALSE, timeout_ms);
+	if (result < WAIT_OBJECT_0 + count)
+	{
+		return (int)(result - WAIT_OBJECT_0);
+	}
+	return -1;
+}
+
+bool event_wait_all(event_t** events, int count, uint32_t timeout_ms)
+{
+	// The kernel waits on at most MAXIMUM_WAIT_OBJECTS handles at a time, so wait
+	// on larger sets in batches, charging each batch's wait against the timeout.
+	ULONGLONG start = GetTickCount64();
+	for (int i = 0; i < count; i += MAXIMUM_WAIT_OBJECTS)
+	{
+		DWORD remaining = timeout_ms;
+		if (timeout_ms != INFINITE)
+		{
+			ULONGLONG elapsed = GetTickCount64() - start;
+			remaining = elapsed < timeout_ms ? (DWORD)(timeout_ms - elapsed) : 0;
+		}
+
+		DWORD batch = (DWORD)__min(count - i, MAXIMUM_WAIT_OBJECTS);
+		DWORD result = WaitForMultipleObjects(batch, (HANDLE*)&events[i], TRUE, remaining);
+		if (result >= WAIT_OBJECT_0 + batch)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
 bool event_is_raised(event_t* event)
 {
 	return WaitForSingleObject(event, 0) == WAIT_OBJECT_0;
@@ -1,24 +1,58 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // Event thread synchronization
 
 // Handle to an event.
 typedef struct event_t event_t;
 
-// Creates a new event.
+// Timeout value that makes the timed waits below wait forever.
+#define EVENT_WAIT_INFINITE 0xffffffffu
+
+// Most events any one call to event_wait_any may wait on.
+#define EVENT_WAIT_ANY_MAX 64
+
+// Creates a new manual-reset event.
+// Once signaled it stays raised until event_reset.
 event_t* event_create();
 
+// Creates a new event.
+// An auto-reset event releases a single waiting thread per signal and
+// lowers itself as it does so; otherwise it behaves as event_create.
+event_t* event_create_ex(bool auto_reset);
+
 // Destroys a previously created event.
 void event_destroy(event_t* event);
 
 // Signals an event.
-// All threads waiting on this event will resume.
+// For a manual-reset event, all threads waiting on this event will resume.
+// For an auto-reset event, one waiting thread resumes, or the next to wait if none is.
 void event_signal(event_t* event);
 
+// Lowers a signaled event.
+void event_reset(event_t* event);
+
 // Waits for an event to be signaled.
 void event_wait(event_t* event);
 
+// Waits up to timeout_ms milliseconds for an event to be signaled.
+// Returns true if it was, false on timeout.
+bool event_wait_timeout(event_t* event, uint32_t timeout_ms);
+
+// Waits up to timeout_ms milliseconds for any of count events to be signaled.
+// Returns the index of a signaled event, the lowest if several are, or -1 on timeout.
+// At most EVENT_WAIT_ANY_MAX events.
+int event_wait_any(event_t** events, int count, uint32_t timeout_ms);
+
+// Waits up to timeout_ms milliseconds for all of count events to be signaled.
+// Returns true if they were, false on timeout.
+// More than EVENT_WAIT_ANY_MAX events are waited on in batches of that many, one after
+// another. Auto-reset events in batches that completed have had their signals consumed
+// even if a later batch times out, so only wait on that many auto-reset events at once.
+bool event_wait_all(event_t** events, int count, uint32_t timeout_ms);
+
 // Determines if an event is signaled.
+// For an auto-reset event this consumes the signal.
 bool event_is_raised(event_t* event);
@@ -1,7 +1,10 @@
 #include "fs.h"
 
+#include "atomic.h"
+#include "debug.h"
 #include "event.h"
 #include "heap.h"
+#include "object_pool.h"
 #include "queue.h"
 #include "thread.h"
 
@@ -13,6 +16,7 @@
 typedef struct fs_t
 {
 	heap_t* heap;
+	object_pool_t* work_pool;
 	queue_t* file_queue;
 	thread_t* file_thread;
 } fs_t;
@@ -21,10 +25,12 @@ typedef enum fs_work_op_t
 {
 	k_fs_work_op_read,
 	k_fs_work_op_write,
+	k_fs_work_op_append,
 } fs_work_op_t;
 
 typedef struct fs_work_t
 {
+	fs_t* fs;
 	heap_t* heap;
 	fs_work_op_t op;
 	char path[1024];
@@ -34,16 +40,31 @@ typedef struct fs_work_t
 	size_t size;
 	event_t* done;
 	int result;
+
+	// Completion callback set by fs_work_notify.
+	// The state moves from none to registered and/or done exactly once each.
+	void (*notify_callback)(void*);
+	void* notify_data;
+	volatile int notify_state;
 } fs_work_t;
 
+enum
+{
+	k_fs_notify_none,
+	k_fs_notify_registered,
+	k_fs_notify_done,
+};
+
+static void fs_work_complete(fs_work_t* work);
 static int file_thread_func(void* user);
 
 fs_t* fs_create(heap_t* heap, int queue_capacity)
 {
 	fs_t* fs = heap_alloc(heap, sizeof(fs_t), 8);
 	fs->heap = heap;
+	fs->work_pool = object_pool_create(heap, sizeof(fs_work_t), 8, queue_capacity);
 	fs->file_queue = queue_create(heap, queue_capacity);
-	fs->file_thread = thread_create(file_thread_func, fs);
+	fs->file_thread = thread_create_ex(file_thread_func, fs, "fs", 0, k_thread_priority_normal, 0);
 	return fs;
 }
 
@@ -52,12 +73,14 @@ void fs_destroy(fs_t* fs)
 	queue_push(fs->file_queue, NULL);
 	thread_destroy(fs->file_thread);
 	queue_destroy(fs->file_queue);
+	object_pool_destroy(fs->work_pool);
 	heap_free(fs->heap, fs);
 }
 
 fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression)
 {
-	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
+	fs_work_t* work = object_pool_get(fs->work_pool);
+	work->fs = fs;
 	work->heap = heap;
 	work->op = k_fs_work_op_read;
 	strcpy_s(work->path, sizeof(work->path), path);
@@ -65,6 +88,9 @@ fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate
 	work->size = 0;
 	work->done = event_create();
 	work->result = 0;
+	work->notify_callback = NULL;
+	work->notify_data = NULL;
+	work->notify_state = k_fs_notify_none;
 	work->null_terminate = null_terminate;
 	work->use_compression = use_compression;
 	queue_push(fs->file_queue, work);
@@ -73,7 +99,8 @@ fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate
 
 fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression)
 {
-	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
+	fs_work_t* work = object_pool_get(fs->work_pool);
+	work->fs = fs;
 	work->heap = fs->heap;
 	work->op = k_fs_work_op_write;
 	strcpy_s(work->path, sizeof(work->path), path);
@@ -81,6 +108,9 @@ fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size,
 	work->size = size;
 	work->done = event_create();
 	work->result = 0;
+	work->notify_callback = NULL;
+	work->notify_data = NULL;
+	work->notify_state = k_fs_notify_none;
 	work->null_terminate = false;
 	work->use_compression = use_compression;
 
@@ -96,6 +126,31 @@ fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size,
 	return work;
 }
 
+fs_work_t* fs_append(fs_t* fs, const char* path, const void* buffer, size_t size)
+{
+	fs_work_t* work = object_pool_get(fs->work_pool);
+	work->fs = fs;
+	work->heap = fs->heap;
+	work->op = k_fs_work_op_append;
+	strcpy_s(work->path, sizeof(work->path), path);
+	work->buffer = (void*)buffer;
+	work->size = size;
+	work->done = event_create();
+	work->result = 0;
+	work->notify_callback = NULL;
+	work->notify_data = NULL;
+	work->notify_state = k_fs_notify_none;
+	work->null_terminate = false;
+	work->use_compression = false;
+	queue_push(fs->file_queue, work);
+	return work;
+}
+
+int fs_get_queue_depth(fs_t* fs)
+{
+	return queue_get_count(fs->file_queue);
+}
+
 bool fs_work_is_done(fs_work_t* work)
 {
 	return work ? event_is_raised(work->done) : true;
@@ -109,6 +164,37 @@ void fs_work_wait(fs_work_t* work)
 	}
 }
 
+bool fs_work_notify(fs_work_t* work, void (*callback)(void*), void* data)
+{
+	if (!work)
+	{
+		return false;
+	}
+	work->notify_callback = callback;
+	work->notify_data = data;
+	return atomic_compare_exchange32(&work->notify_state, k_fs_notify_none, k_fs_notify_registered, k_atomic_release) == k_fs_notify_none;
+}
+
+int fs_work_wait_any(fs_work_t** work, int count, uint32_t timeout_ms)
+{
+	if (count <= 0 || count > EVENT_WAIT_ANY_MAX)
+	{
+		debug_print(k_print_error, "Cannot wait on %d file work objects at once!\n", count);
+		return -1;
+	}
+
+	event_t* events[EVENT_WAIT_ANY_MAX];
+	for (int i = 0; i < count; ++i)
+	{
+		if (!work[i])
+		{
+			return i;
+		}
+		events[i] = work[i]->done;
+	}
+	return event_wait_any(events, count, timeout_ms);
+}
+
 int fs_work_get_result(fs_work_t* work)
 {
 	fs_work_wait(work);
@@ -133,7 +219,7 @@ void fs_work_destroy(fs_work_t* work)
 	{
 		event_wait(work->done);
 		event_destroy(work->done);
-		heap_free(work->heap, work);
+		object_pool_put(work->fs->work_pool, work);
 	}
 }
 
@@ -143,7 +229,7 @@ static void file_read(fs_work_t* work)
 	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
 	{
 		work->result = -1;
-		event_signal(work->done);
+		fs_work_complete(work);
 		return;
 	}
 
@@ -152,7 +238,7 @@ static void file_read(fs_work_t* work)
 	if (handle == INVALID_HANDLE_VALUE)
 	{
 		work->result = GetLastError();
-		event_signal(work->done);
+		fs_work_complete(work);
 		return;
 	}
 
@@ -160,7 +246,7 @@ static void file_read(fs_work_t* work)
 	{
 		work->result = GetLastError();
 		CloseHandle(handle);
-		event_signal(work->done);
+		fs_work_complete(work);
 		return;
 	}
 
@@ -171,7 +257,7 @@ static void file_read(fs_work_t* work)
 	{
 		work->result = GetLastError();
 		CloseHandle(handle);
-		event_signal(work->done);
+		fs_work_complete(work);
 		return;
 	}
 
@@ -189,7 +275,7 @@ static void file_read(fs_work_t* work)
 	}
 	else
 	{
-		event_signal(work->done);
+		fs_work_complete(work);
 	}
 }
 
@@ -199,16 +285,17 @@ static void file_write(fs_work_t* work)
 	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
 	{
 		work->result = -1;
-		event_signal(work->done);
+		fs_work_complete(work);
 		return;
 	}
 
-	HANDLE handle = CreateFile(wide_path, GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
-		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	bool append = work->op == k_fs_work_op_append;
+	HANDLE handle = CreateFile(wide_path, append ? FILE_APPEND_DATA : GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
+		append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (handle == INVALID_HANDLE_VALUE)
 	{
 		work->result = GetLastError();
-		event_signal(work->done);
+		fs_work_complete(work);
 		return;
 	}
 
@@ -217,7 +304,7 @@ static void file_write(fs_work_t* work)
 	{
 		work->result = GetLastError();
 		CloseHandle(handle);
-		event_signal(work->done);
+		fs_work_complete(work);
 		return;
 	}
 
@@ -225,7 +312,7 @@ static void file_write(fs_work_t* work)
 
 	CloseHandle(handle);
 
-	event_signal(work->done);
+	fs_work_complete(work);
 }
 
 static int file_thread_func(void* user)
@@ -245,9 +332,24 @@ static int file_thread_func(void* user)
 			file_read(work);
 			break;
 		case k_fs_work_op_write:
+		case k_fs_work_op_append:
 			file_write(work);
 			break;
 		}
 	}
 	return 0;
 }
+
+static void fs_work_complete(fs_work_t* work)
+{
+	// Once the event is raised the owner may destroy the work and the pool may
+	// hand it out again, so settle the notify state and take the callback first.
+	int state = atomic_exchange32(&work->notify_state, k_fs_notify_done, k_atomic_seq_cst);
+	void (*callback)(void*) = work->notify_callback;
+	void* data = work->notify_data;
+	event_signal(work->done);
+	if (state == k_fs_notify_registered)
+	{
+		callback(data);
+	}
+}
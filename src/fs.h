@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // Asynchronous read/write file system.
 
@@ -32,12 +33,36 @@ fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate
 // Returns a work object.
 fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression);
 
+// Queue an append to a file.
+// The buffer is added to the end of the file at the specified path, creating it if needed.
+// File work runs in the order it is queued, so a file can be streamed out as a series of appends.
+// The buffer must remain valid until the work completes.
+// Returns a work object.
+fs_work_t* fs_append(fs_t* fs, const char* path, const void* buffer, size_t size);
+
+// Get the number of file operations queued and not yet started.
+int fs_get_queue_depth(fs_t* fs);
+
 // If true, the file work is complete.
 bool fs_work_is_done(fs_work_t* work);
 
 // Block for the file work to complete.
 void fs_work_wait(fs_work_t* work);
 
+// Block for any of count file work objects to complete, for up to timeout_ms milliseconds.
+// Pass EVENT_WAIT_INFINITE from event.h to wait forever.
+// Returns the index of a completed work object, or -1 on timeout.
+// NULL work counts as complete. At most EVENT_WAIT_ANY_MAX work objects; more
+// is an error and returns -1 without waiting.
+int fs_work_wait_any(fs_work_t** work, int count, uint32_t timeout_ms);
+
+// Register a function to be called once when the file work completes.
+// The callback runs on the file system's thread. Only one callback may be registered.
+// It may run after fs_work_wait returns and after the work is destroyed, so data must
+// stay valid until the callback itself has run.
+// Returns false, without calling it, if the work is already complete.
+bool fs_work_notify(fs_work_t* work, void (*callback)(void*), void* data);
+
 // Get the error code for the file work.
 // A value of zero generally indicates success.
 int fs_work_get_result(fs_work_t* work);
@@ -1,30 +1,222 @@
 #include "heap.h"
 
+#include "atomic.h"
 #include "debug.h"
+#include "lz4/xxhash.h"
 #include "mutex.h"
+#include "semaphore.h"
 #include "tlsf/tlsf.h"
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+enum
+{
+	// Small allocations are served from per-thread caches of fixed size classes.
+	// Class N holds blocks of k_heap_cache_min_size << N bytes.
+	k_heap_cache_class_count = k_heap_stats_size_class_count - 1,
+	k_heap_cache_min_size = 16,
+	k_heap_cache_max_size = k_heap_cache_min_size << (k_heap_cache_class_count - 1),
+	k_heap_cache_alignment = 16,
+
+	// Number of blocks a cache can hold per class,
+	// and the number moved to/from the TLSF heap at once.
+	k_heap_cache_capacity = 32,
+	k_heap_cache_batch = 16,
+
+	// Free spans smaller than this are not worth discarding when trimming.
+	k_heap_trim_min_span = 64 * 1024,
+
+	// Page ranges remembered as reset between trims.
+	k_heap_trim_max_spans = 256,
+
+	k_heap_page_size = 4096,
+
+	// Sampled allocation profiling.
+	// Capacities are powers of two for hashing.
+	k_heap_profile_max_frames = 16,
+	k_heap_profile_site_capacity = 4096,
+	k_heap_profile_sample_capacity = 64 * 1024,
+};
+
+// Marks a sample slot whose allocation was freed.
+#define HEAP_PROFILE_TOMBSTONE ((void*)1)
+
+// Header at the front of each arena allocation.
+// The TLSF pool starts right after it and gets every remaining byte of the allocation,
+// so pool sizes are always computed as allocation size less sizeof(arena_t).
 typedef struct arena_t
 {
 	pool_t pool;
+	size_t size;
 	struct arena_t* next;
 } arena_t;
 
+// TLSF requires pool memory aligned to a pointer.
+_Static_assert(sizeof(arena_t) % sizeof(void*) == 0, "arena_t must keep the pool after it aligned");
+
+// A range of whole pages.
+typedef struct heap_span_t
+{
+	uintptr_t begin;
+	uintptr_t end;
+} heap_span_t;
+
+typedef struct heap_cache_bin_t
+{
+	int count;
+	void* blocks[k_heap_cache_capacity];
+} heap_cache_bin_t;
+
+typedef struct heap_cache_t
+{
+	heap_t* heap;
+	struct heap_cache_t* next;
+	struct heap_cache_t* prev;
+	size_t cached_bytes;
+	uint64_t alloc_counts[k_heap_stats_size_class_count];
+	int64_t profile_countdown_bytes;
+	int64_t profile_countdown_allocs;
+	heap_cache_bin_t bins[k_heap_cache_class_count];
+} heap_cache_t;
+
+// A unique allocation callstack and the sampled allocations made from it.
+typedef struct heap_profile_site_t
+{
+	uint64_t hash;
+	int frame_count;
+	void* frames[k_heap_profile_max_frames];
+	size_t live_bytes;
+	size_t live_count;
+	uint64_t alloc_bytes;
+	uint64_t alloc_count;
+} heap_profile_site_t;
+
+// A sampled allocation that has not been freed yet.
+typedef struct heap_profile_sample_t
+{
+	void* volatile address;
+	size_t size;
+	int site;
+} heap_profile_sample_t;
+
+typedef struct heap_profile_t
+{
+	mutex_t* mutex;
+	size_t sample_bytes;
+	size_t sample_allocs;
+
+	// Countdowns for threads without a cache.
+	int64_t countdown_bytes;
+	int64_t countdown_allocs;
+
+	// Odd while the sample table is being rebuilt.
+	volatile int generation;
+
+	int sample_slots_used;
+	int sample_live_count;
+	heap_profile_site_t sites[k_heap_profile_site_capacity];
+	heap_profile_sample_t samples[k_heap_profile_sample_capacity];
+} heap_profile_t;
+
+typedef struct heap_frame_arena_t
+{
+	heap_t* heap;
+	semaphore_t* free_frames;
+	char* base;
+	size_t frame_size;
+	int frame_count;
+	int frame_index;
+	volatile int64_t offset;
+} heap_frame_arena_t;
+
 typedef struct heap_t
 {
 	tlsf_t tlsf;
 	size_t grow_increment;
 	arena_t* arena;
+
+	char* reserve_base;
+	size_t reserve_size;
+	size_t reserve_committed;
+	size_t large_page_size;
+
 	mutex_t* mutex;
+	heap_cache_t* caches;
+
+	// Caches are per thread, not per fiber, so the fibers of the job system share their
+	// thread's cache instead of each hoarding one. Threads not running fibers also set
+	// a fiber local slot, only for its callback to flush the cache when they exit.
+	DWORD cache_index;
+	DWORD cache_exit_index;
+
+	size_t used_bytes;
+	size_t peak_bytes;
+	uint64_t alloc_counts[k_heap_stats_size_class_count];
+
+	size_t trim_threshold;
+	size_t freed_since_trim;
+
+	// Pages reset by the last trim that nothing has been allocated over since.
+	// Trims do not reset them again or count them as released a second time.
+	heap_span_t reset_spans[k_heap_trim_max_spans];
+	int reset_span_count;
+
+	heap_profile_t* profile;
 } heap_t;
 
+typedef struct heap_walk_t
+{
+	size_t free_bytes;
+	size_t largest_free_block;
+	int used_count;
+
+	// Trim state: bytes freshly reset and the spans reset so far.
+	heap_t* heap;
+	size_t discarded_bytes;
+	heap_span_t* spans;
+	int span_count;
+} heap_walk_t;
+
+static int heap_size_class(size_t size);
+static size_t heap_enable_large_pages();
+static bool heap_grow(heap_t* heap, size_t size);
+static void* heap_alloc_locked(heap_t* heap, size_t size, size_t alignment);
+static void heap_free_locked(heap_t* heap, void* address);
+static void heap_walk_arena(void* ptr, size_t size, int used, void* user);
+static void heap_walk_discard(void* ptr, size_t size, int used, void* user);
+static size_t heap_trim_locked(heap_t* heap);
+static size_t heap_reset_overlap(heap_t* heap, uintptr_t begin, uintptr_t end);
+static void heap_touch_reset_spans(heap_t* heap, void* address, size_t size);
+static heap_cache_t* heap_cache_get(heap_t* heap);
+static heap_profile_t* heap_profile_create(const heap_info_t* info);
+static void heap_profile_destroy(heap_profile_t* profile);
+static void heap_profile_alloc(heap_t* heap, heap_cache_t* cache, void* address, size_t size);
+static void heap_profile_free(heap_profile_t* profile, void* address);
+static int heap_profile_find_sample(heap_profile_t* profile, void* address);
+static void heap_profile_insert_sample(heap_profile_t* profile, void* address, size_t size, int site);
+static void heap_profile_place_sample(heap_profile_t* profile, void* address, size_t size, int site);
+static int heap_profile_compare_sites(const void* a, const void* b);
+static void heap_cache_refill(heap_cache_t* cache, int size_class);
+static void heap_cache_flush(heap_cache_t* cache, int size_class, int count);
+static void heap_cache_destroy(void* user);
+
 heap_t* heap_create(size_t grow_increment)
+{
+	heap_info_t info =
+	{
+		.grow_increment = grow_increment,
+	};
+	return heap_create_ex(&info);
+}
+
+heap_t* heap_create_ex(const heap_info_t* info)
 {
 	heap_t* heap = VirtualAlloc(NULL, sizeof(heap_t) + tlsf_size(),
 		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
@@ -36,57 +228,382 @@ heap_t* heap_create(size_t grow_increment)
 		return NULL;
 	}
 
-	heap->mutex = mutex_create();
-	heap->grow_increment = grow_increment;
+	heap->mutex = mutex_create_named("heap");
+	heap->grow_increment = info->grow_increment;
 	heap->tlsf = tlsf_create(heap + 1);
 	heap->arena = NULL;
 
+	heap->reserve_base = NULL;
+	heap->reserve_size = 0;
+	heap->reserve_committed = 0;
+	heap->large_page_size = 0;
+	if (info->large_pages)
+	{
+		heap->large_page_size = heap_enable_large_pages();
+		if (!heap->large_page_size)
+		{
+			debug_print(
+				k_print_warning,
+				"Large pages unavailable, heap using normal pages.\n");
+		}
+	}
+	if (info->reserve_size && !heap->large_page_size)
+	{
+		heap->reserve_base = VirtualAlloc(NULL, info->reserve_size, MEM_RESERVE, PAGE_NOACCESS);
+		if (heap->reserve_base)
+		{
+			heap->reserve_size = info->reserve_size;
+		}
+		else
+		{
+			debug_print(
+				k_print_warning,
+				"Heap failed to reserve address space, growing in separate arenas.\n");
+		}
+	}
+	heap->caches = NULL;
+	heap->used_bytes = 0;
+	heap->peak_bytes = 0;
+	memset(heap->alloc_counts, 0, sizeof(heap->alloc_counts));
+	heap->trim_threshold = 0;
+	heap->freed_since_trim = 0;
+	heap->reset_span_count = 0;
+
+	heap->profile = NULL;
+	if (info->profile_sample_bytes || info->profile_sample_allocs)
+	{
+		heap->profile = heap_profile_create(info);
+	}
+
+	heap->cache_index = TlsAlloc();
+	heap->cache_exit_index = FlsAlloc(heap_cache_destroy);
+	if (heap->cache_index == TLS_OUT_OF_INDEXES)
+	{
+		debug_print(
+			k_print_warning,
+			"Heap thread caches unavailable!\n");
+	}
+
 	return heap;
 }
 
 void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 {
-	mutex_lock(heap->mutex);
+	void* address = NULL;
+	heap_cache_t* cache = NULL;
+
+	int size_class = heap_size_class(size);
+	if (size_class < k_heap_cache_class_count && alignment <= k_heap_cache_alignment)
+	{
+		cache = heap_cache_get(heap);
+		if (cache)
+		{
+			heap_cache_bin_t* bin = &cache->bins[size_class];
+			if (bin->count == 0)
+			{
+				heap_cache_refill(cache, size_class);
+			}
+			if (bin->count > 0)
+			{
+				address = bin->blocks[--bin->count];
+				cache->cached_bytes -= tlsf_block_size(address);
+				cache->alloc_counts[size_class]++;
+			}
+		}
+	}
 
-	void* address = tlsf_memalign(heap->tlsf, alignment, size);
 	if (!address)
 	{
-		size_t arena_size =
-			__max(heap->grow_increment, size * 2) +
-			sizeof(arena_t);
-		arena_t* arena = VirtualAlloc(NULL,
-			arena_size + tlsf_pool_overhead(),
-			MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-		if (!arena)
+		mutex_lock(heap->mutex);
+		address = heap_alloc_locked(heap, size, alignment);
+		if (address)
 		{
-			debug_print(
-				k_print_error,
-				"OUT OF MEMORY!\n");
-			return NULL;
+			heap->alloc_counts[size_class]++;
 		}
+		mutex_unlock(heap->mutex);
+	}
 
-		arena->pool = tlsf_add_pool(heap->tlsf, arena + 1, arena_size);
+	if (heap->profile && address)
+	{
+		heap_profile_alloc(heap, cache, address, size);
+	}
 
-		arena->next = heap->arena;
-		heap->arena = arena;
+	return address;
+}
 
-		address = tlsf_memalign(heap->tlsf, alignment, size);
+void* heap_realloc(heap_t* heap, void* address, size_t size, size_t alignment)
+{
+	if (!address)
+	{
+		return heap_alloc(heap, size, alignment);
+	}
+	if (!size)
+	{
+		heap_free(heap, address);
+		return NULL;
+	}
+
+	mutex_lock(heap->mutex);
+
+	size_t old_size = tlsf_block_size(address);
+	void* new_address = NULL;
+	if (alignment <= tlsf_align_size())
+	{
+		// TLSF resizes in place when the next block is free; grow the heap only if that fails.
+		new_address = tlsf_realloc(heap->tlsf, address, size);
+		if (!new_address && heap_grow(heap, size))
+		{
+			new_address = tlsf_realloc(heap->tlsf, address, size);
+		}
+		if (new_address)
+		{
+			heap_touch_reset_spans(heap, new_address, tlsf_block_size(new_address));
+			heap->used_bytes += tlsf_block_size(new_address);
+			heap->used_bytes -= old_size;
+			heap->peak_bytes = __max(heap->peak_bytes, heap->used_bytes);
+		}
+	}
+	else if (old_size >= size)
+	{
+		// tlsf_realloc only honors the default alignment, keep over-aligned blocks that still fit.
+		new_address = address;
+	}
+	else
+	{
+		new_address = heap_alloc_locked(heap, size, alignment);
+		if (new_address)
+		{
+			memcpy(new_address, address, old_size);
+			heap_free_locked(heap, address);
+		}
+	}
+	if (new_address)
+	{
+		heap->alloc_counts[heap_size_class(size)]++;
+
+		// On failure the old block stays live and keeps its sample.
+		// Dropping it under the heap lock means no other thread can have
+		// been handed the old address and sampled it in the meantime.
+		if (heap->profile)
+		{
+			heap_profile_free(heap->profile, address);
+		}
 	}
 
 	mutex_unlock(heap->mutex);
 
-	return address;
+	if (heap->profile && new_address)
+	{
+		heap_profile_alloc(heap, NULL, new_address, size);
+	}
+
+	return new_address;
 }
 
 void heap_free(heap_t* heap, void* address)
 {
+	if (!address)
+	{
+		return;
+	}
+
+	if (heap->profile)
+	{
+		heap_profile_free(heap->profile, address);
+	}
+
+	// Any block big enough for a size class and suitably aligned can be reused by that class.
+	size_t block_size = tlsf_block_size(address);
+	if (block_size >= k_heap_cache_min_size &&
+		block_size < k_heap_cache_max_size * 2 &&
+		((uintptr_t)address & (k_heap_cache_alignment - 1)) == 0)
+	{
+		heap_cache_t* cache = heap_cache_get(heap);
+		if (cache)
+		{
+			int size_class = 0;
+			while (size_class + 1 < k_heap_cache_class_count &&
+				((size_t)k_heap_cache_min_size << (size_class + 1)) <= block_size)
+			{
+				++size_class;
+			}
+
+			heap_cache_bin_t* bin = &cache->bins[size_class];
+			if (bin->count == k_heap_cache_capacity)
+			{
+				heap_cache_flush(cache, size_class, k_heap_cache_batch);
+			}
+			bin->blocks[bin->count++] = address;
+			cache->cached_bytes += block_size;
+			return;
+		}
+	}
+
 	mutex_lock(heap->mutex);
-	tlsf_free(heap->tlsf, address);
+	heap_free_locked(heap, address);
 	mutex_unlock(heap->mutex);
 }
 
+size_t heap_trim(heap_t* heap)
+{
+	if (heap->cache_index != TLS_OUT_OF_INDEXES)
+	{
+		heap_cache_t* cache = TlsGetValue(heap->cache_index);
+		if (cache)
+		{
+			for (int i = 0; i < k_heap_cache_class_count; ++i)
+			{
+				heap_cache_flush(cache, i, cache->bins[i].count);
+			}
+		}
+	}
+
+	mutex_lock(heap->mutex);
+	size_t released = heap_trim_locked(heap);
+	mutex_unlock(heap->mutex);
+	return released;
+}
+
+void heap_set_auto_trim(heap_t* heap, size_t trim_threshold)
+{
+	mutex_lock(heap->mutex);
+	heap->trim_threshold = trim_threshold;
+	heap->freed_since_trim = 0;
+	mutex_unlock(heap->mutex);
+}
+
+void heap_profile_report(heap_t* heap)
+{
+	heap_profile_t* profile = heap->profile;
+	if (!profile)
+	{
+		debug_print(
+			k_print_warning,
+			"Heap profiling is not enabled.\n");
+		return;
+	}
+
+	mutex_lock(profile->mutex);
+
+	heap_profile_site_t** sites = VirtualAlloc(NULL, sizeof(heap_profile_site_t*) * k_heap_profile_site_capacity,
+		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!sites)
+	{
+		mutex_unlock(profile->mutex);
+		return;
+	}
+
+	int count = 0;
+	for (int i = 0; i < k_heap_profile_site_capacity; ++i)
+	{
+		if (profile->sites[i].live_count)
+		{
+			sites[count++] = &profile->sites[i];
+		}
+	}
+	qsort(sites, count, sizeof(sites[0]), heap_profile_compare_sites);
+
+	debug_print(
+		k_print_info,
+		"Heap profile: %d callstacks with live samples, 1 sample per %zu bytes / %zu allocations.\n",
+		count, profile->sample_bytes, profile->sample_allocs);
+	for (int i = 0; i < count; ++i)
+	{
+		debug_print(
+			k_print_info,
+			"%zu bytes live in %zu samples (%llu samples, %llu bytes total):\n",
+			sites[i]->live_bytes, sites[i]->live_count, sites[i]->alloc_count, sites[i]->alloc_bytes);
+		for (int f = 0; f < sites[i]->frame_count; ++f)
+		{
+			char symbol[200];
+			debug_symbolicate(sites[i]->frames[f], symbol, sizeof(symbol));
+			debug_print(k_print_info, "    %s\n", symbol);
+		}
+	}
+
+	VirtualFree(sites, 0, MEM_RELEASE);
+
+	mutex_unlock(profile->mutex);
+}
+
+void heap_get_stats(heap_t* heap, heap_stats_t* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	mutex_lock(heap->mutex);
+
+	for (heap_cache_t* cache = heap->caches; cache; cache = cache->next)
+	{
+		stats->cached_bytes += cache->cached_bytes;
+		for (int i = 0; i < k_heap_stats_size_class_count; ++i)
+		{
+			stats->alloc_counts[i] += cache->alloc_counts[i];
+		}
+	}
+	for (int i = 0; i < k_heap_stats_size_class_count; ++i)
+	{
+		stats->alloc_counts[i] += heap->alloc_counts[i];
+	}
+	stats->live_bytes = heap->used_bytes > stats->cached_bytes ? heap->used_bytes - stats->cached_bytes : 0;
+	stats->peak_bytes = heap->peak_bytes;
+
+	heap_walk_t walk = { 0 };
+	for (arena_t* arena = heap->arena; arena; arena = arena->next)
+	{
+		tlsf_walk_pool(arena->pool, heap_walk_arena, &walk);
+		stats->arena_bytes += arena->size;
+		stats->arena_count++;
+	}
+	stats->free_bytes = walk.free_bytes;
+	stats->largest_free_block = walk.largest_free_block;
+	if (walk.free_bytes)
+	{
+		stats->fragmentation = 1.0f - (float)walk.largest_free_block / (float)walk.free_bytes;
+	}
+
+	mutex_unlock(heap->mutex);
+}
+
+size_t heap_get_live_bytes(heap_t* heap)
+{
+	mutex_lock(heap->mutex);
+
+	size_t cached_bytes = 0;
+	for (heap_cache_t* cache = heap->caches; cache; cache = cache->next)
+	{
+		cached_bytes += cache->cached_bytes;
+	}
+	size_t live_bytes = heap->used_bytes > cached_bytes ? heap->used_bytes - cached_bytes : 0;
+
+	mutex_unlock(heap->mutex);
+	return live_bytes;
+}
+
 void heap_destroy(heap_t* heap)
 {
+	if (heap->profile)
+	{
+		if (heap->profile->sample_live_count)
+		{
+			debug_print(
+				k_print_warning,
+				"Heap destroyed with sampled allocations still live:\n");
+			heap_profile_report(heap);
+		}
+		heap_profile_destroy(heap->profile);
+	}
+
+	// Flushes the caches of threads that registered for exit back to the heap.
+	// Caches first used on fibers are simply released with the arenas.
+	if (heap->cache_exit_index != FLS_OUT_OF_INDEXES)
+	{
+		FlsFree(heap->cache_exit_index);
+	}
+	if (heap->cache_index != TLS_OUT_OF_INDEXES)
+	{
+		TlsFree(heap->cache_index);
+	}
+
 	tlsf_destroy(heap->tlsf);
 
 	arena_t* arena = heap->arena;
@@ -96,8 +613,703 @@ void heap_destroy(heap_t* heap)
 		VirtualFree(arena, 0, MEM_RELEASE);
 		arena = next;
 	}
+	if (heap->reserve_base && !heap->reserve_committed)
+	{
+		VirtualFree(heap->reserve_base, 0, MEM_RELEASE);
+	}
 
 	mutex_destroy(heap->mutex);
 
 	VirtualFree(heap, 0, MEM_RELEASE);
 }
+
+heap_frame_arena_t* heap_frame_arena_create(heap_t* heap, size_t frame_size, int frame_count)
+{
+	heap_frame_arena_t* arena = heap_alloc(heap, sizeof(heap_frame_arena_t), 8);
+	arena->heap = heap;
+	arena->base = heap_alloc(heap, frame_size * frame_count, 64);
+	arena->free_frames = semaphore_create_named(frame_count - 1, frame_count - 1, "frame arena");
+	arena->frame_size = frame_size;
+	arena->frame_count = frame_count;
+	arena->frame_index = 0;
+	arena->offset = 0;
+	return arena;
+}
+
+void heap_frame_arena_destroy(heap_frame_arena_t* arena)
+{
+	semaphore_destroy(arena->free_frames);
+	heap_free(arena->heap, arena->base);
+	heap_free(arena->heap, arena);
+}
+
+void* heap_frame_arena_alloc(heap_frame_arena_t* arena, size_t size, size_t alignment)
+{
+	// Reserve enough to align the result ourselves so that a single atomic add suffices.
+	size_t padded_size = size + alignment - 1;
+	size_t offset = (size_t)atomic_fetch_add64(&arena->offset, (int64_t)padded_size, k_atomic_relaxed);
+	if (offset + padded_size > arena->frame_size)
+	{
+		debug_print(
+			k_print_warning,
+			"Frame arena out of space!\n");
+		return NULL;
+	}
+
+	uintptr_t address = (uintptr_t)&arena->base[arena->frame_size * arena->frame_index + offset];
+	return (void*)((address + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+void heap_frame_arena_advance(heap_frame_arena_t* arena)
+{
+	semaphore_acquire(arena->free_frames);
+	arena->frame_index = (arena->frame_index + 1) % arena->frame_count;
+	arena->offset = 0;
+}
+
+void heap_frame_arena_retire(heap_frame_arena_t* arena)
+{
+	semaphore_release(arena->free_frames);
+}
+
+static int heap_size_class(size_t size)
+{
+	int size_class = 0;
+	while (size_class < k_heap_cache_class_count &&
+		((size_t)k_heap_cache_min_size << size_class) < size)
+	{
+		++size_class;
+	}
+	return size_class;
+}
+
+static size_t heap_enable_large_pages()
+{
+	size_t large_page_size = GetLargePageMinimum();
+	if (!large_page_size)
+	{
+		return 0;
+	}
+
+	// Large pages require the lock pages in memory privilege be granted and enabled.
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+	{
+		return 0;
+	}
+
+	TOKEN_PRIVILEGES privileges = { .PrivilegeCount = 1 };
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled =
+		LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+		GetLastError() != ERROR_NOT_ALL_ASSIGNED;
+	CloseHandle(token);
+
+	return enabled ? large_page_size : 0;
+}
+
+static bool heap_grow(heap_t* heap, size_t size)
+{
+	size_t grow_size = __max(heap->grow_increment, size * 2);
+
+	// Reserved heaps commit more of the range and extend their single arena in place.
+	if (heap->reserve_base)
+	{
+		size_t committed = heap->reserve_committed;
+		size_t new_committed =
+			(committed + grow_size + sizeof(arena_t) + tlsf_pool_overhead() + k_heap_page_size - 1) &
+			~(size_t)(k_heap_page_size - 1);
+		if (new_committed <= heap->reserve_size &&
+			VirtualAlloc(heap->reserve_base + committed, new_committed - committed, MEM_COMMIT, PAGE_READWRITE))
+		{
+			arena_t* arena = (arena_t*)heap->reserve_base;
+			size_t pool_size = new_committed - sizeof(arena_t);
+			if (!committed)
+			{
+				arena->pool = tlsf_add_pool(heap->tlsf, arena + 1, pool_size);
+				arena->size = pool_size;
+				arena->next = heap->arena;
+				heap->arena = arena;
+				heap->reserve_committed = new_committed;
+				return true;
+			}
+			if (tlsf_extend_pool(heap->tlsf, arena->pool, arena->size, pool_size))
+			{
+				arena->size = pool_size;
+				heap->reserve_committed = new_committed;
+				return true;
+			}
+		}
+	}
+
+	// Room for the header, grow_size bytes of blocks and TLSF's own overhead.
+	size_t arena_size = sizeof(arena_t) + grow_size + tlsf_pool_overhead();
+	arena_t* arena = NULL;
+	if (heap->large_page_size)
+	{
+		// Large page allocations must be a multiple of the large page size, give the slack to the pool.
+		size_t large_size =
+			(arena_size + heap->large_page_size - 1) &
+			~(heap->large_page_size - 1);
+		arena = VirtualAlloc(NULL, large_size,
+			MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (arena)
+		{
+			arena_size = large_size;
+		}
+	}
+	if (!arena)
+	{
+		arena = VirtualAlloc(NULL, arena_size,
+			MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	}
+	if (!arena)
+	{
+		debug_print(
+			k_print_error,
+			"OUT OF MEMORY!\n");
+		return false;
+	}
+
+	size_t pool_size = arena_size - sizeof(arena_t);
+	arena->pool = tlsf_add_pool(heap->tlsf, arena + 1, pool_size);
+	arena->size = pool_size;
+
+	arena->next = heap->arena;
+	heap->arena = arena;
+	return true;
+}
+
+static void* heap_alloc_locked(heap_t* heap, size_t size, size_t alignment)
+{
+	void* address = tlsf_memalign(heap->tlsf, alignment, size);
+	if (!address && heap_grow(heap, size))
+	{
+		address = tlsf_memalign(heap->tlsf, alignment, size);
+	}
+	if (address)
+	{
+		heap_touch_reset_spans(heap, address, tlsf_block_size(address));
+		heap->used_bytes += tlsf_block_size(address);
+		heap->peak_bytes = __max(heap->peak_bytes, heap->used_bytes);
+	}
+	return address;
+}
+
+static void heap_free_locked(heap_t* heap, void* address)
+{
+	size_t block_size = tlsf_block_size(address);
+	heap->used_bytes -= block_size;
+	tlsf_free(heap->tlsf, address);
+
+	if (heap->trim_threshold)
+	{
+		heap->freed_since_trim += block_size;
+		if (heap->freed_since_trim >= heap->trim_threshold)
+		{
+			heap_trim_locked(heap);
+		}
+	}
+}
+
+static size_t heap_trim_locked(heap_t* heap)
+{
+	heap->freed_since_trim = 0;
+
+	int arena_count = 0;
+	for (arena_t* arena = heap->arena; arena; arena = arena->next)
+	{
+		arena_count++;
+	}
+
+	heap_span_t spans[k_heap_trim_max_spans];
+	int span_count = 0;
+
+	size_t released = 0;
+	arena_t** link = &heap->arena;
+	while (*link)
+	{
+		arena_t* arena = *link;
+
+		heap_walk_t walk = { 0 };
+		tlsf_walk_pool(arena->pool, heap_walk_arena, &walk);
+		// The reserved arena is kept, later growth extends it in place.
+		if (walk.used_count == 0 && arena_count > 1 && (char*)arena != heap->reserve_base)
+		{
+			*link = arena->next;
+			arena_count--;
+			released += arena->size;
+			tlsf_remove_pool(heap->tlsf, arena->pool);
+			VirtualFree(arena, 0, MEM_RELEASE);
+			continue;
+		}
+
+		heap_walk_t discard = { .heap = heap, .spans = spans, .span_count = span_count };
+		tlsf_walk_pool(arena->pool, heap_walk_discard, &discard);
+		released += discard.discarded_bytes;
+		span_count = discard.span_count;
+
+		link = &arena->next;
+	}
+
+	// Spans of released arenas and of blocks allocated since are forgotten.
+	memcpy(heap->reset_spans, spans, sizeof(heap_span_t) * span_count);
+	heap->reset_span_count = span_count;
+	return released;
+}
+
+static size_t heap_reset_overlap(heap_t* heap, uintptr_t begin, uintptr_t end)
+{
+	size_t overlap = 0;
+	for (int i = 0; i < heap->reset_span_count; ++i)
+	{
+		uintptr_t overlap_begin = __max(begin, heap->reset_spans[i].begin);
+		uintptr_t overlap_end = __min(end, heap->reset_spans[i].end);
+		if (overlap_begin < overlap_end)
+		{
+			overlap += overlap_end - overlap_begin;
+		}
+	}
+	return overlap;
+}
+
+static void heap_touch_reset_spans(heap_t* heap, void* address, size_t size)
+{
+	// Splitting a free block writes TLSF headers just outside the allocated block,
+	// so a page either side counts as touched too.
+	uintptr_t begin = ((uintptr_t)address & ~(uintptr_t)(k_heap_page_size - 1)) - k_heap_page_size;
+	uintptr_t end = (((uintptr_t)address + size + k_heap_page_size - 1) & ~(uintptr_t)(k_heap_page_size - 1)) + k_heap_page_size;
+	for (int i = 0; i < heap->reset_span_count;)
+	{
+		heap_span_t span = heap->reset_spans[i];
+		if (span.end <= begin || end <= span.begin)
+		{
+			++i;
+			continue;
+		}
+
+		// Keep the untouched pages on either side. If there is no room to
+		// track both, the remainder is simply reset and counted again later.
+		heap->reset_spans[i] = heap->reset_spans[--heap->reset_span_count];
+		if (span.begin < begin)
+		{
+			heap->reset_spans[heap->reset_span_count++] = (heap_span_t){ span.begin, begin };
+		}
+		if (end < span.end && heap->reset_span_count < k_heap_trim_max_spans)
+		{
+			heap->reset_spans[heap->reset_span_count++] = (heap_span_t){ end, span.end };
+		}
+	}
+}
+
+static void heap_walk_arena(void* ptr, size_t size, int used, void* user)
+{
+	heap_walk_t* walk = user;
+	if (!used)
+	{
+		walk->free_bytes += size;
+		walk->largest_free_block = __max(walk->largest_free_block, size);
+	}
+	else
+	{
+		walk->used_count++;
+	}
+}
+
+static void heap_walk_discard(void* ptr, size_t size, int used, void* user)
+{
+	heap_walk_t* walk = user;
+	if (used || size < k_heap_trim_min_span)
+	{
+		return;
+	}
+
+	// TLSF keeps free list links at the start of a free block and
+	// the next block's back pointer at its end; leave those pages resident.
+	uintptr_t begin = ((uintptr_t)ptr + k_heap_page_size) & ~(uintptr_t)(k_heap_page_size - 1);
+	uintptr_t end = ((uintptr_t)ptr + size - sizeof(void*)) & ~(uintptr_t)(k_heap_page_size - 1);
+	if (begin >= end)
+	{
+		return;
+	}
+
+	// Only pages not already reset by an earlier trim need resetting and count as released.
+	size_t fresh = (end - begin) - heap_reset_overlap(walk->heap, begin, end);
+	if (fresh)
+	{
+		if (!VirtualAlloc((void*)begin, end - begin, MEM_RESET, PAGE_READWRITE))
+		{
+			return;
+		}
+		// A reset alone leaves the pages resident. Unlocking pages that were never locked
+		// fails with ERROR_NOT_LOCKED but still removes them from the working set.
+		VirtualUnlock((void*)begin, end - begin);
+	}
+	walk->discarded_bytes += fresh;
+	if (walk->span_count < k_heap_trim_max_spans)
+	{
+		walk->spans[walk->span_count++] = (heap_span_t){ begin, end };
+	}
+}
+
+static heap_cache_t* heap_cache_get(heap_t* heap)
+{
+	if (heap->cache_index == TLS_OUT_OF_INDEXES)
+	{
+		return NULL;
+	}
+
+	heap_cache_t* cache = TlsGetValue(heap->cache_index);
+	if (!cache)
+	{
+		mutex_lock(heap->mutex);
+		cache = heap_alloc_locked(heap, sizeof(heap_cache_t), 8);
+		mutex_unlock(heap->mutex);
+		if (!cache)
+		{
+			return NULL;
+		}
+
+		memset(cache, 0, sizeof(*cache));
+		cache->heap = heap;
+		TlsSetValue(heap->cache_index, cache);
+
+		// Fiber local values follow the fiber, so the exit callback could run on whatever
+		// thread deletes it while this thread still uses the cache. Only plain threads register;
+		// a thread first using the heap from a fiber keeps its cache until the heap is destroyed.
+		if (heap->cache_exit_index != FLS_OUT_OF_INDEXES && !IsThreadAFiber())
+		{
+			FlsSetValue(heap->cache_exit_index, cache);
+		}
+
+		mutex_lock(heap->mutex);
+		cache->next = heap->caches;
+		if (heap->caches)
+		{
+			heap->caches->prev = cache;
+		}
+		heap->caches = cache;
+		mutex_unlock(heap->mutex);
+	}
+	return cache;
+}
+
+static void heap_cache_refill(heap_cache_t* cache, int size_class)
+{
+	heap_t* heap = cache->heap;
+	heap_cache_bin_t* bin = &cache->bins[size_class];
+	size_t size = (size_t)k_heap_cache_min_size << size_class;
+
+	mutex_lock(heap->mutex);
+	while (bin->count < k_heap_cache_batch)
+	{
+		void* address = heap_alloc_locked(heap, size, k_heap_cache_alignment);
+		if (!address)
+		{
+			break;
+		}
+		bin->blocks[bin->count++] = address;
+		cache->cached_bytes += tlsf_block_size(address);
+	}
+	mutex_unlock(heap->mutex);
+}
+
+static void heap_cache_flush(heap_cache_t* cache, int size_class, int count)
+{
+	heap_t* heap = cache->heap;
+	heap_cache_bin_t* bin = &cache->bins[size_class];
+
+	// Return the oldest blocks and keep the recently freed ones, which are likely hot.
+	mutex_lock(heap->mutex);
+	for (int i = 0; i < count; ++i)
+	{
+		cache->cached_bytes -= tlsf_block_size(bin->blocks[i]);
+		heap_free_locked(heap, bin->blocks[i]);
+	}
+	mutex_unlock(heap->mutex);
+
+	bin->count -= count;
+	memmove(&bin->blocks[0], &bin->blocks[count], sizeof(void*) * bin->count);
+}
+
+static void heap_cache_destroy(void* user)
+{
+	heap_cache_t* cache = user;
+	heap_t* heap = cache->heap;
+
+	// Called on the exiting thread, or on the thread destroying the heap.
+	if (TlsGetValue(heap->cache_index) == cache)
+	{
+		TlsSetValue(heap->cache_index, NULL);
+	}
+
+	for (int i = 0; i < k_heap_cache_class_count; ++i)
+	{
+		heap_cache_flush(cache, i, cache->bins[i].count);
+	}
+
+	mutex_lock(heap->mutex);
+	for (int i = 0; i < k_heap_stats_size_class_count; ++i)
+	{
+		heap->alloc_counts[i] += cache->alloc_counts[i];
+	}
+	if (cache->prev)
+	{
+		cache->prev->next = cache->next;
+	}
+	else
+	{
+		heap->caches = cache->next;
+	}
+	if (cache->next)
+	{
+		cache->next->prev = cache->prev;
+	}
+	heap_free_locked(heap, cache);
+	mutex_unlock(heap->mutex);
+}
+
+static heap_profile_t* heap_profile_create(const heap_info_t* info)
+{
+	// The profile lives outside the heap so that profiling never allocates from it.
+	heap_profile_t* profile = VirtualAlloc(NULL, sizeof(heap_profile_t),
+		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!profile)
+	{
+		debug_print(
+			k_print_warning,
+			"Heap profile failed to allocate!\n");
+		return NULL;
+	}
+
+	profile->mutex = mutex_create_named("heap profile");
+	profile->sample_bytes = info->profile_sample_bytes;
+	profile->sample_allocs = info->profile_sample_allocs;
+	return profile;
+}
+
+static void heap_profile_destroy(heap_profile_t* profile)
+{
+	mutex_destroy(profile->mutex);
+	VirtualFree(profile, 0, MEM_RELEASE);
+}
+
+static void heap_profile_alloc(heap_t* heap, heap_cache_t* cache, void* address, size_t size)
+{
+	heap_profile_t* profile = heap->profile;
+
+	if (!cache)
+	{
+		cache = heap_cache_get(heap);
+	}
+
+	// Each thread counts down to its next sample in its own cache.
+	int64_t* countdown_bytes = cache ? &cache->profile_countdown_bytes : &profile->countdown_bytes;
+	int64_t* countdown_allocs = cache ? &cache->profile_countdown_allocs : &profile->countdown_allocs;
+	if (!cache)
+	{
+		mutex_lock(profile->mutex);
+	}
+	bool sample = false;
+	if (profile->sample_bytes)
+	{
+		*countdown_bytes -= size;
+		if (*countdown_bytes <= 0)
+		{
+			*countdown_bytes = profile->sample_bytes;
+			sample = true;
+		}
+	}
+	if (profile->sample_allocs)
+	{
+		if (--*countdown_allocs <= 0)
+		{
+			*countdown_allocs = profile->sample_allocs;
+			sample = true;
+		}
+	}
+	if (!cache)
+	{
+		mutex_unlock(profile->mutex);
+	}
+	if (!sample)
+	{
+		return;
+	}
+
+	void* frames[k_heap_profile_max_frames];
+	int frame_count = debug_backtrace(frames, _countof(frames));
+	uint64_t hash = XXH64(frames, sizeof(void*) * frame_count, 0);
+
+	mutex_lock(profile->mutex);
+
+	int site = -1;
+	for (int i = 0; i < k_heap_profile_site_capacity; ++i)
+	{
+		int index = (int)((hash + i) & (k_heap_profile_site_capacity - 1));
+		heap_profile_site_t* it = &profile->sites[index];
+		if (!it->frame_count)
+		{
+			it->hash = hash;
+			it->frame_count = frame_count;
+			memcpy(it->frames, frames, sizeof(void*) * frame_count);
+			site = index;
+			break;
+		}
+		if (it->hash == hash && it->frame_count == frame_count &&
+			memcmp(it->frames, frames, sizeof(void*) * frame_count) == 0)
+		{
+			site = index;
+			break;
+		}
+	}
+
+	if (site >= 0)
+	{
+		heap_profile_site_t* it = &profile->sites[site];
+		it->live_bytes += size;
+		it->live_count++;
+		it->alloc_bytes += size;
+		it->alloc_count++;
+		heap_profile_insert_sample(profile, address, size, site);
+	}
+
+	mutex_unlock(profile->mutex);
+}
+
+static void heap_profile_free(heap_profile_t* profile, void* address)
+{
+	// Most frees are of unsampled allocations. Probe without the lock,
+	// and only trust a miss if the table was not rebuilt meanwhile.
+	int generation = atomic_load32(&profile->generation, k_atomic_acquire);
+	if (!(generation & 1) && heap_profile_find_sample(profile, address) < 0)
+	{
+		// Keep the probe's reads ahead of the second look at the generation.
+		atomic_fence(k_atomic_acquire);
+		if (atomic_load32(&profile->generation, k_atomic_relaxed) == generation)
+		{
+			return;
+		}
+	}
+
+	mutex_lock(profile->mutex);
+
+	int index = heap_profile_find_sample(profile, address);
+	if (index >= 0)
+	{
+		heap_profile_sample_t* sample = &profile->samples[index];
+		heap_profile_site_t* site = &profile->sites[sample->site];
+		site->live_bytes -= sample->size;
+		site->live_count--;
+		sample->address = HEAP_PROFILE_TOMBSTONE;
+		profile->sample_live_count--;
+	}
+
+	mutex_unlock(profile->mutex);
+}
+
+static int heap_profile_find_sample(heap_profile_t* profile, void* address)
+{
+	uint64_t hash = XXH64(&address, sizeof(address), 0);
+	for (int i = 0; i < k_heap_profile_sample_capacity; ++i)
+	{
+		int index = (int)((hash + i) & (k_heap_profile_sample_capacity - 1));
+		void* it = profile->samples[index].address;
+		if (it == address)
+		{
+			return index;
+		}
+		if (!it)
+		{
+			break;
+		}
+	}
+	return -1;
+}
+
+static void heap_profile_insert_sample(heap_profile_t* profile, void* address, size_t size, int site)
+{
+	// Freed slots stay as tombstones so lock-free probes never stop early.
+	// Once they clog the table, rebuild it with only live samples.
+	if (profile->sample_slots_used >= k_heap_profile_sample_capacity / 2)
+	{
+		heap_profile_sample_t* live = VirtualAlloc(NULL, sizeof(profile->samples),
+			MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!live)
+		{
+			return;
+		}
+
+		int live_count = 0;
+		for (int i = 0; i < k_heap_profile_sample_capacity; ++i)
+		{
+			if (profile->samples[i].address && profile->samples[i].address != HEAP_PROFILE_TOMBSTONE)
+			{
+				live[live_count++] = profile->samples[i];
+			}
+		}
+
+		atomic_fetch_add32(&profile->generation, 1, k_atomic_seq_cst);
+		memset(profile->samples, 0, sizeof(profile->samples));
+		profile->sample_slots_used = 0;
+		profile->sample_live_count = 0;
+		for (int i = 0; i < live_count; ++i)
+		{
+			heap_profile_place_sample(profile, live[i].address, live[i].size, live[i].site);
+		}
+		atomic_fetch_add32(&profile->generation, 1, k_atomic_seq_cst);
+
+		VirtualFree(live, 0, MEM_RELEASE);
+
+		if (profile->sample_slots_used >= k_heap_profile_sample_capacity / 2)
+		{
+			debug_print(
+				k_print_warning,
+				"Heap profile sample table full!\n");
+			return;
+		}
+	}
+
+	heap_profile_place_sample(profile, address, size, site);
+}
+
+static void heap_profile_place_sample(heap_profile_t* profile, void* address, size_t size, int site)
+{
+	uint64_t hash = XXH64(&address, sizeof(address), 0);
+	for (int i = 0; i < k_heap_profile_sample_capacity; ++i)
+	{
+		int index = (int)((hash + i) & (k_heap_profile_sample_capacity - 1));
+		heap_profile_sample_t* sample = &profile->samples[index];
+		if (!sample->address || sample->address == HEAP_PROFILE_TOMBSTONE || sample->address == address)
+		{
+			// A stale sample at the same address means its free was missed; drop it.
+			if (sample->address == address)
+			{
+				profile->sites[sample->site].live_bytes -= sample->size;
+				profile->sites[sample->site].live_count--;
+				profile->sample_live_count--;
+			}
+			else if (!sample->address)
+			{
+				profile->sample_slots_used++;
+			}
+			profile->sample_live_count++;
+			sample->size = size;
+			sample->site = site;
+			sample->address = address;
+			return;
+		}
+	}
+}
+
+static int heap_profile_compare_sites(const void* a, const void* b)
+{
+	const heap_profile_site_t* site_a = *(const heap_profile_site_t**)a;
+	const heap_profile_site_t* site_b = *(const heap_profile_site_t**)b;
+	if (site_a->live_bytes != site_b->live_bytes)
+	{
+		return site_a->live_bytes < site_b->live_bytes ? 1 : -1;
+	}
+	return 0;
+}
@@ -1,25 +1,143 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 // Heap Memory Manager
 // 
 // Main object, heap_t, represents a dynamic memory heap.
 // Once created, memory can be allocated and free from the heap.
+// Small allocations are served from per-thread caches without taking the heap lock.
 
 // Handle to a heap.
 typedef struct heap_t heap_t;
 
+// Handle to a per-frame linear allocator.
+typedef struct heap_frame_arena_t heap_frame_arena_t;
+
+enum
+{
+	// Allocations are counted by size class: up to 16, 32, ... 2048 bytes, then larger.
+	k_heap_stats_size_class_count = 9,
+};
+
+// Snapshot of heap memory usage.
+typedef struct heap_stats_t
+{
+	// Bytes currently allocated by callers of the heap.
+	size_t live_bytes;
+	// Bytes held in per-thread caches, allocated from the arenas but not in use.
+	size_t cached_bytes;
+	// Highest number of bytes ever allocated from the arenas, including cached bytes.
+	size_t peak_bytes;
+	// Total bytes of all arenas and the number of arenas.
+	size_t arena_bytes;
+	int arena_count;
+	// Bytes in free blocks across all arenas, and the size of the largest one.
+	size_t free_bytes;
+	size_t largest_free_block;
+	// Zero when all free memory is in one block, approaching one as it splinters.
+	float fragmentation;
+	// Number of allocations made by size class.
+	uint64_t alloc_counts[k_heap_stats_size_class_count];
+} heap_stats_t;
+
+// Options for creating a heap with heap_create_ex().
+typedef struct heap_info_t
+{
+	// Default size with which the heap grows.
+	// Should be a multiple of OS page size.
+	size_t grow_increment;
+	// If non-zero, size of a virtual address range reserved up front.
+	// The heap commits the range a grow increment at a time as one contiguous arena,
+	// so free blocks are never split at arena edges. Grows with separate arenas once full.
+	size_t reserve_size;
+	// If true, back arenas with large (2 MB) pages to reduce TLB misses.
+	// Large pages cannot be committed incrementally, so when they are available
+	// no range is reserved. Falls back to normal pages when unavailable.
+	bool large_pages;
+	// If either is non-zero, the callstack of about one allocation per this many bytes,
+	// or one per this many allocations, is recorded for heap_profile_report().
+	size_t profile_sample_bytes;
+	size_t profile_sample_allocs;
+} heap_info_t;
+
 // Creates a new memory heap.
 // The grow increment is the default size with which the heap grows.
 // Should be a multiple of OS page size.
 heap_t* heap_create(size_t grow_increment);
 
+// Creates a new memory heap with the specified options.
+heap_t* heap_create_ex(const heap_info_t* info);
+
 // Destroy a previously created heap.
 void heap_destroy(heap_t* heap);
 
 // Allocate memory from a heap.
 void* heap_alloc(heap_t* heap, size_t size, size_t alignment);
 
+// Resize memory previously allocated from a heap.
+// Grows or shrinks the allocation in place when the adjacent memory allows,
+// otherwise moves it to a new allocation with the contents copied.
+// Behaves as heap_alloc if address is NULL, and as heap_free if size is zero.
+// Returns the new address, or NULL if out of memory (address remains valid).
+void* heap_realloc(heap_t* heap, void* address, size_t size, size_t alignment);
+
 // Free memory previously allocated from a heap.
+// Memory may be freed from a different thread than the one that allocated it.
 void heap_free(heap_t* heap, void* address);
+
+// Return unused heap memory to the operating system.
+// Arenas with no allocations are released, except for one kept to serve future allocations.
+// Large free spans inside remaining arenas are reset and removed from the working set:
+// the OS may drop their contents instead of paging them out, and they no longer count
+// toward resident memory until they are reused. They stay committed and still count
+// against the commit charge.
+// Blocks cached by the calling thread are returned to the heap first.
+// Returns the number of bytes released: arenas freed plus pages newly removed from the
+// working set. Pages removed by an earlier trim and not reused since are not counted again.
+size_t heap_trim(heap_t* heap);
+
+// Trim a heap automatically after trim_threshold bytes have been freed back to it.
+// A threshold of zero disables automatic trimming, which is the default.
+void heap_set_auto_trim(heap_t* heap, size_t trim_threshold);
+
+// Log the sampled allocation profile of a heap.
+// Lists callstacks with live sampled allocations, largest first.
+// The same report is logged on heap_destroy if any sampled allocations leaked.
+void heap_profile_report(heap_t* heap);
+
+// Gather current memory usage of a heap.
+// Walks every arena, so it is too expensive to call for every allocation.
+// Values contributed by per-thread caches are approximate while other threads are running.
+void heap_get_stats(heap_t* heap, heap_stats_t* stats);
+
+// Get the number of bytes currently allocated by callers of the heap.
+// Same as live_bytes from heap_get_stats without walking the arenas, so cheap enough for every frame.
+size_t heap_get_live_bytes(heap_t* heap);
+
+// Creates a per-frame linear allocator out of a heap.
+// For transient data that lives until a consumer is done with the frame, such as commands
+// handed from the game thread to another thread, without a heap_alloc and heap_free per item.
+// Reserves frame_count buffers of frame_size bytes each; frame_count must be at least 2.
+// One buffer is filled while up to frame_count - 1 previous frames are still in use.
+heap_frame_arena_t* heap_frame_arena_create(heap_t* heap, size_t frame_size, int frame_count);
+
+// Destroy a previously created frame arena.
+void heap_frame_arena_destroy(heap_frame_arena_t* arena);
+
+// Allocate memory from the current frame of a frame arena.
+// Safe for multiple threads to allocate at the same time.
+// Memory is never freed individually, it is reclaimed when its frame is retired.
+// Returns NULL if the current frame is out of space.
+void* heap_frame_arena_alloc(heap_frame_arena_t* arena, size_t size, size_t alignment);
+
+// Finish the current frame and begin allocating from the next one.
+// If the next frame has not been retired, blocks until it is.
+// Must not be called while other threads are allocating.
+void heap_frame_arena_advance(heap_frame_arena_t* arena);
+
+// Release the oldest finished frame so its memory can be reused.
+// Frames are retired in the order they were finished.
+void heap_frame_arena_retire(heap_frame_arena_t* arena);
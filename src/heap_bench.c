@@ -0,0 +1,463 @@
+#include "heap_bench.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "event.h"
+#include "heap.h"
+#include "queue.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <malloc.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+
+enum
+{
+	// Operations (one alloc or one free) performed by each thread per run.
+	k_heap_bench_ops = 200000,
+
+	// Every Nth operation is timed for the latency percentiles.
+	k_heap_bench_latency_stride = 8,
+	k_heap_bench_latency_capacity = k_heap_bench_ops / k_heap_bench_latency_stride,
+
+	// Live allocations held by each thread in the game workload.
+	k_heap_bench_game_slots = 1024,
+
+	// Live allocations held by each thread in the churn workload.
+	k_heap_bench_churn_slots = 64,
+
+	k_heap_bench_queue_capacity = 1024,
+
+	k_heap_bench_max_threads = 64,
+};
+
+typedef enum heap_bench_workload_t
+{
+	// Mostly small allocations with a long tail of large ones,
+	// freed in random order by the allocating thread.
+	k_heap_bench_game,
+
+	// Half the threads allocate and hand blocks to the other half to free.
+	k_heap_bench_producer_consumer,
+
+	// Short lived allocations with alignments between 8 and 4096 bytes.
+	k_heap_bench_churn,
+
+	k_heap_bench_workload_count,
+} heap_bench_workload_t;
+
+static const char* k_heap_bench_workload_names[k_heap_bench_workload_count] =
+{
+	"game",
+	"producer_consumer",
+	"churn",
+};
+
+// Allocator under test.
+typedef struct heap_bench_allocator_t
+{
+	const char* name;
+	void* (*alloc)(void* context, size_t size, size_t alignment);
+	void (*free)(void* context, void* address);
+	void* context;
+} heap_bench_allocator_t;
+
+typedef struct heap_bench_run_t heap_bench_run_t;
+
+typedef struct heap_bench_thread_t
+{
+	heap_bench_run_t* run;
+	int index;
+	queue_t* queue;
+	uint32_t random;
+	int op_count;
+	int latency_count;
+	uint32_t* latencies;
+} heap_bench_thread_t;
+
+typedef struct heap_bench_run_t
+{
+	heap_bench_allocator_t* allocator;
+	heap_bench_workload_t workload;
+	int thread_count;
+	event_t* start;
+	int done_count;
+	heap_bench_thread_t threads[k_heap_bench_max_threads];
+} heap_bench_run_t;
+
+static void* heap_bench_heap_alloc(void* context, size_t size, size_t alignment);
+static void heap_bench_heap_free(void* context, void* address);
+static void* heap_bench_malloc_alloc(void* context, size_t size, size_t alignment);
+static void heap_bench_malloc_free(void* context, void* address);
+static void heap_bench_run_one(heap_t* heap, heap_bench_allocator_t* allocator, heap_bench_workload_t workload, int thread_count);
+static int heap_bench_thread_func(void* user);
+static void heap_bench_game(heap_bench_thread_t* thread);
+static void heap_bench_produce(heap_bench_thread_t* thread);
+static void heap_bench_consume(heap_bench_thread_t* thread);
+static void heap_bench_churn(heap_bench_thread_t* thread);
+static void* heap_bench_alloc(heap_bench_thread_t* thread, size_t size, size_t alignment);
+static void heap_bench_free(heap_bench_thread_t* thread, void* address);
+static uint32_t heap_bench_random(heap_bench_thread_t* thread);
+static size_t heap_bench_game_size(heap_bench_thread_t* thread);
+static size_t heap_bench_working_set();
+static int heap_bench_compare_latency(const void* a, const void* b);
+
+void heap_bench_run(int max_threads)
+{
+	if (max_threads < 1)
+	{
+		max_threads = 1;
+	}
+	if (max_threads > k_heap_bench_max_threads)
+	{
+		max_threads = k_heap_bench_max_threads;
+	}
+
+	// Queues and latency buffers come from their own heap so they are not part of the measurement.
+	heap_t* bench_heap = heap_create(2 * 1024 * 1024);
+
+	debug_print(k_print_info, "allocator,workload,threads,ops_per_sec,p99_ns,peak_working_set_kb\n");
+
+	for (int workload = 0; workload < k_heap_bench_workload_count; ++workload)
+	{
+		// Producer/consumer runs use pairs of threads, so a single thread run would repeat the two thread one.
+		int first_thread_count = (workload == k_heap_bench_producer_consumer && max_threads > 1) ? 2 : 1;
+		for (int thread_count = first_thread_count; ; thread_count *= 2)
+		{
+			if (thread_count > max_threads)
+			{
+				thread_count = max_threads;
+			}
+
+			heap_t* heap = heap_create(2 * 1024 * 1024);
+			heap_bench_allocator_t heap_allocator =
+			{
+				.name = "heap",
+				.alloc = heap_bench_heap_alloc,
+				.free = heap_bench_heap_free,
+				.context = heap,
+			};
+			heap_bench_run_one(bench_heap, &heap_allocator, workload, thread_count);
+			heap_destroy(heap);
+
+			heap_bench_allocator_t malloc_allocator =
+			{
+				.name = "malloc",
+				.alloc = heap_bench_malloc_alloc,
+				.free = heap_bench_malloc_free,
+			};
+			heap_bench_run_one(bench_heap, &malloc_allocator, workload, thread_count);
+
+			if (thread_count == max_threads)
+			{
+				break;
+			}
+		}
+	}
+
+	heap_destroy(bench_heap);
+}
+
+static void* heap_bench_heap_alloc(void* context, size_t size, size_t alignment)
+{
+	return heap_alloc(context, size, alignment);
+}
+
+static void heap_bench_heap_free(void* context, void* address)
+{
+	heap_free(context, address);
+}
+
+static void* heap_bench_malloc_alloc(void* context, size_t size, size_t alignment)
+{
+	return _aligned_malloc(size, alignment);
+}
+
+static void heap_bench_malloc_free(void* context, void* address)
+{
+	_aligned_free(address);
+}
+
+static void heap_bench_run_one(heap_t* heap, heap_bench_allocator_t* allocator, heap_bench_workload_t workload, int thread_count)
+{
+	// The producer/consumer workload always needs at least one thread of each kind.
+	if (workload == k_heap_bench_producer_consumer)
+	{
+		thread_count = thread_count < 2 ? 2 : thread_count & ~1;
+	}
+
+	heap_bench_run_t* run = heap_alloc(heap, sizeof(heap_bench_run_t), 8);
+	run->allocator = allocator;
+	run->workload = workload;
+	run->thread_count = thread_count;
+	run->start = event_create();
+	run->done_count = 0;
+
+	thread_t* threads[k_heap_bench_max_threads];
+	for (int i = 0; i < thread_count; ++i)
+	{
+		heap_bench_thread_t* thread = &run->threads[i];
+		thread->run = run;
+		thread->index = i;
+		thread->queue = (i & 1) ? run->threads[i - 1].queue : queue_create(heap, k_heap_bench_queue_capacity);
+		thread->random = 0x9e3779b9u * (i + 1);
+		thread->op_count = 0;
+		thread->latency_count = 0;
+		thread->latencies = heap_alloc(heap, sizeof(uint32_t) * k_heap_bench_latency_capacity, 8);
+		threads[i] = thread_create(heap_bench_thread_func, thread);
+	}
+
+	size_t peak_working_set = heap_bench_working_set();
+	uint64_t start_ticks = timer_get_ticks();
+	event_signal(run->start);
+
+	// Sample the working set while the threads run; the OS peak counter can never be reset between runs.
+	while (atomic_load(&run->done_count) < thread_count)
+	{
+		size_t working_set = heap_bench_working_set();
+		if (working_set > peak_working_set)
+		{
+			peak_working_set = working_set;
+		}
+		thread_sleep(1);
+	}
+	uint64_t duration_ticks = timer_get_ticks() - start_ticks;
+
+	for (int i = 0; i < thread_count; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+
+	// Merge the samples of every thread for the percentile.
+	int latency_count = 0;
+	for (int i = 0; i < thread_count; ++i)
+	{
+		latency_count += run->threads[i].latency_count;
+	}
+	uint32_t* latencies = heap_alloc(heap, sizeof(uint32_t) * (latency_count + 1), 8);
+	latency_count = 0;
+	for (int i = 0; i < thread_count; ++i)
+	{
+		heap_bench_thread_t* thread = &run->threads[i];
+		memcpy(latencies + latency_count, thread->latencies, sizeof(uint32_t) * thread->latency_count);
+		latency_count += thread->latency_count;
+		heap_free(heap, thread->latencies);
+	}
+	qsort(latencies, latency_count, sizeof(uint32_t), heap_bench_compare_latency);
+	uint64_t p99_ticks = latency_count ? latencies[(latency_count * 99) / 100] : 0;
+	heap_free(heap, latencies);
+
+	uint64_t ticks_per_second = timer_get_ticks_per_second();
+	double seconds = (double)duration_ticks / ticks_per_second;
+	double ops_per_second = seconds > 0.0 ? ((double)k_heap_bench_ops * thread_count) / seconds : 0.0;
+	double p99_ns = (double)p99_ticks * 1000000000.0 / ticks_per_second;
+
+	debug_print(k_print_info, "%s,%s,%d,%.0f,%.0f,%zu\n",
+		allocator->name,
+		k_heap_bench_workload_names[workload],
+		thread_count,
+		ops_per_second,
+		p99_ns,
+		peak_working_set / 1024);
+
+	for (int i = 0; i < thread_count; i += 2)
+	{
+		queue_destroy(run->threads[i].queue);
+	}
+	event_destroy(run->start);
+	heap_free(heap, run);
+}
+
+static int heap_bench_thread_func(void* user)
+{
+	heap_bench_thread_t* thread = user;
+	event_wait(thread->run->start);
+
+	switch (thread->run->workload)
+	{
+	case k_heap_bench_game:
+		heap_bench_game(thread);
+		break;
+	case k_heap_bench_producer_consumer:
+		if (thread->index & 1)
+		{
+			heap_bench_consume(thread);
+		}
+		else
+		{
+			heap_bench_produce(thread);
+		}
+		break;
+	case k_heap_bench_churn:
+		heap_bench_churn(thread);
+		break;
+	default:
+		break;
+	}
+
+	atomic_increment(&thread->run->done_count);
+	return 0;
+}
+
+static void heap_bench_game(heap_bench_thread_t* thread)
+{
+	void* slots[k_heap_bench_game_slots] = { 0 };
+
+	for (int op = 0; op < k_heap_bench_ops; ++op)
+	{
+		int slot = heap_bench_random(thread) % k_heap_bench_game_slots;
+		if (slots[slot])
+		{
+			heap_bench_free(thread, slots[slot]);
+			slots[slot] = NULL;
+		}
+		else
+		{
+			size_t size = heap_bench_game_size(thread);
+			char* address = heap_bench_alloc(thread, size, 16);
+			address[0] = address[size - 1] = 1;
+			slots[slot] = address;
+		}
+	}
+
+	for (int i = 0; i < k_heap_bench_game_slots; ++i)
+	{
+		if (slots[i])
+		{
+			thread->run->allocator->free(thread->run->allocator->context, slots[i]);
+		}
+	}
+}
+
+static void heap_bench_produce(heap_bench_thread_t* thread)
+{
+	for (int op = 0; op < k_heap_bench_ops; ++op)
+	{
+		size_t size = 16 + heap_bench_random(thread) % 496;
+		char* address = heap_bench_alloc(thread, size, 16);
+		address[0] = address[size - 1] = 1;
+		queue_push(thread->queue, address);
+	}
+}
+
+static void heap_bench_consume(heap_bench_thread_t* thread)
+{
+	// Each consumer shares a queue with one producer and frees exactly what it allocates.
+	for (int op = 0; op < k_heap_bench_ops; ++op)
+	{
+		heap_bench_free(thread, queue_pop(thread->queue));
+	}
+}
+
+static void heap_bench_churn(heap_bench_thread_t* thread)
+{
+	void* slots[k_heap_bench_churn_slots] = { 0 };
+
+	// Each iteration performs a free and an alloc, so count both.
+	for (int op = 0; op < k_heap_bench_ops; op += 2)
+	{
+		int slot = (op / 2) % k_heap_bench_churn_slots;
+		if (slots[slot])
+		{
+			heap_bench_free(thread, slots[slot]);
+		}
+
+		size_t alignment = (size_t)8 << (heap_bench_random(thread) % 10);
+		size_t size = 16 + heap_bench_random(thread) % 1008;
+		char* address = heap_bench_alloc(thread, size, alignment);
+		address[0] = address[size - 1] = 1;
+		slots[slot] = address;
+	}
+
+	for (int i = 0; i < k_heap_bench_churn_slots; ++i)
+	{
+		if (slots[i])
+		{
+			thread->run->allocator->free(thread->run->allocator->context, slots[i]);
+		}
+	}
+}
+
+static void* heap_bench_alloc(heap_bench_thread_t* thread, size_t size, size_t alignment)
+{
+	heap_bench_allocator_t* allocator = thread->run->allocator;
+	if (thread->op_count++ % k_heap_bench_latency_stride)
+	{
+		return allocator->alloc(allocator->context, size, alignment);
+	}
+
+	uint64_t start_ticks = timer_get_ticks();
+	void* address = allocator->alloc(allocator->context, size, alignment);
+	thread->latencies[thread->latency_count++] = (uint32_t)(timer_get_ticks() - start_ticks);
+	return address;
+}
+
+static void heap_bench_free(heap_bench_thread_t* thread, void* address)
+{
+	heap_bench_allocator_t* allocator = thread->run->allocator;
+	if (thread->op_count++ % k_heap_bench_latency_stride)
+	{
+		allocator->free(allocator->context, address);
+		return;
+	}
+
+	uint64_t start_ticks = timer_get_ticks();
+	allocator->free(allocator->context, address);
+	thread->latencies[thread->latency_count++] = (uint32_t)(timer_get_ticks() - start_ticks);
+}
+
+static uint32_t heap_bench_random(heap_bench_thread_t* thread)
+{
+	// xorshift32
+	uint32_t x = thread->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	thread->random = x;
+	return x;
+}
+
+static size_t heap_bench_game_size(heap_bench_thread_t* thread)
+{
+	// 70% small, 25% medium, 4% large, 1% very large.
+	uint32_t bucket = heap_bench_random(thread) % 100;
+	uint32_t r = heap_bench_random(thread);
+	if (bucket < 70)
+	{
+		return 16 + r % 240;
+	}
+	else if (bucket < 95)
+	{
+		return 256 + r % 3840;
+	}
+	else if (bucket < 99)
+	{
+		return 4096 + r % (60 * 1024);
+	}
+	return 64 * 1024 + r % (960 * 1024);
+}
+
+static size_t heap_bench_working_set()
+{
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return 0;
+	}
+	return counters.WorkingSetSize;
+}
+
+static int heap_bench_compare_latency(const void* a, const void* b)
+{
+	uint32_t left = *(const uint32_t*)a;
+	uint32_t right = *(const uint32_t*)b;
+	return (left > right) - (left < right);
+}
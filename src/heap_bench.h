@@ -0,0 +1,9 @@
+#pragma once
+
+// Heap allocator benchmarks.
+
+// Runs every heap workload against the engine heap and the system allocator.
+// Each workload is run at 1, 2, 4, ... up to max_threads threads.
+// Results are printed as one CSV row per run: allocator, workload, thread count,
+// operations per second, p99 operation latency and peak working set.
+void heap_bench_run(int max_threads);
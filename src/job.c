@@ -0,0 +1,616 @@
+#include "job.h"
+
+#include "atomic.h"
+#include "fs.h"
+#include "heap.h"
+#include "object_pool.h"
+#include "queue.h"
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	k_job_cache_line = 64,
+
+	// Jobs each worker's deque can hold; a power of two.
+	// Jobs that do not fit go to the shared queue.
+	k_job_deque_capacity = 4096,
+
+	k_job_shared_queue_capacity = 4096,
+
+	// Jobs and counters are carved from pools in chunks of this many elements.
+	k_job_pool_chunk = 1024,
+
+	// Failed searches for work before an idle worker parks.
+	k_job_spin_count = 256,
+
+	// How often job_wait looks for new work to help with while its counter is non-zero.
+	k_job_wait_poll_ms = 1,
+
+	// Fibers jobs run on. Each job blocked in job_wait holds one;
+	// once all are taken, further waits fall back to blocking the worker.
+	k_job_fiber_count = 128,
+	k_job_fiber_stack_commit = 16 * 1024,
+	k_job_fiber_stack_reserve = 256 * 1024,
+};
+
+typedef struct job_t
+{
+	void (*function)(void*);
+	void* data;
+	job_counter_t* counter;
+} job_t;
+
+// A fiber from the job system's pool.
+// Free fibers are either fresh or suspended in job_schedule;
+// fibers parked on a counter are suspended in job_wait.
+typedef struct job_fiber_t
+{
+	void* fiber;
+	job_system_t* jobs;
+	struct job_fiber_t* next;
+} job_fiber_t;
+
+typedef struct job_counter_t
+{
+	job_system_t* jobs;
+	volatile int value;
+
+	// Guards waiters. The final decrement happens under the lock,
+	// so a fiber parking on the counter either sees zero or gets woken.
+	volatile int lock;
+	job_fiber_t* waiters;
+} job_counter_t;
+
+// A worker and its Chase-Lev deque.
+// The owner pushes and pops at the bottom; thieves take from the top.
+typedef struct job_worker_t
+{
+	job_system_t* jobs;
+	thread_t* thread;
+	int index;
+
+	// The fiber the worker thread started on; shutdown switches back to it.
+	void* thread_fiber;
+
+	// Work left over from the last fiber switch. A fiber cannot free itself
+	// or publish itself as waiting while still running on its own stack,
+	// so whichever fiber runs next finishes the job in job_after_switch.
+	job_fiber_t* pending_free;
+	job_fiber_t* pending_wait;
+	job_counter_t* pending_counter;
+
+	char pad0[k_job_cache_line];
+	volatile int64_t top;
+	char pad1[k_job_cache_line];
+	volatile int64_t bottom;
+	char pad2[k_job_cache_line];
+
+	job_t* volatile deque[k_job_deque_capacity];
+} job_worker_t;
+
+typedef struct job_system_t
+{
+	heap_t* heap;
+	object_pool_t* job_pool;
+	object_pool_t* counter_pool;
+	queue_t* shared_queue;
+	DWORD worker_tls;
+	int worker_count;
+	job_worker_t* workers;
+
+	job_fiber_t* fibers;
+	queue_t* free_fibers;
+
+	// Fibers whose counter reached zero, waiting for a worker to resume them.
+	queue_t* ready_fibers;
+
+	volatile int running;
+
+	// Idle workers park on signal, which job_run bumps only when sleepers is non-zero.
+	volatile int sleepers;
+	volatile int signal;
+} job_system_t;
+
+static int job_worker_func(void* user);
+static void WINAPI job_fiber_func(void* user);
+static void job_schedule(job_system_t* jobs, job_fiber_t* self);
+static void job_switch(job_system_t* jobs, job_fiber_t* fiber);
+static void job_after_switch(job_worker_t* worker);
+static void job_ready(job_system_t* jobs, job_fiber_t* fiber);
+static void job_wake(job_system_t* jobs);
+static void job_counter_decrement(job_counter_t* counter);
+static void job_counter_lock(job_counter_t* counter);
+static void job_counter_unlock(job_counter_t* counter);
+static void job_fs_work_done(void* user);
+static job_t* job_find(job_system_t* jobs, job_worker_t* worker);
+static void job_execute(job_system_t* jobs, job_t* job);
+static bool job_deque_push(job_worker_t* worker, job_t* job);
+static job_t* job_deque_pop(job_worker_t* worker);
+static job_t* job_deque_steal(job_worker_t* victim);
+
+job_system_t* job_system_create(heap_t* heap, int worker_count)
+{
+	if (worker_count <= 0)
+	{
+		worker_count = __max(thread_get_logical_core_count() - 1, 1);
+	}
+
+	job_system_t* jobs = heap_alloc(heap, sizeof(job_system_t), 8);
+	jobs->heap = heap;
+	jobs->job_pool = object_pool_create(heap, sizeof(job_t), 8, k_job_pool_chunk);
+	jobs->counter_pool = object_pool_create(heap, sizeof(job_counter_t), 8, k_job_pool_chunk);
+	jobs->shared_queue = queue_create(heap, k_job_shared_queue_capacity);
+	jobs->worker_tls = TlsAlloc();
+	jobs->worker_count = worker_count;
+	jobs->running = 1;
+	jobs->sleepers = 0;
+	jobs->signal = 0;
+
+	jobs->free_fibers = queue_create(heap, k_job_fiber_count);
+	jobs->ready_fibers = queue_create(heap, k_job_fiber_count);
+	jobs->fibers = heap_alloc(heap, sizeof(job_fiber_t) * k_job_fiber_count, 8);
+	for (int i = 0; i < k_job_fiber_count; ++i)
+	{
+		job_fiber_t* fiber = &jobs->fibers[i];
+		fiber->jobs = jobs;
+		fiber->next = NULL;
+		fiber->fiber = CreateFiberEx(k_job_fiber_stack_commit, k_job_fiber_stack_reserve,
+			FIBER_FLAG_FLOAT_SWITCH, job_fiber_func, fiber);
+		queue_push(jobs->free_fibers, fiber);
+	}
+
+	jobs->workers = heap_alloc(heap, sizeof(job_worker_t) * worker_count, k_job_cache_line);
+	for (int i = 0; i < worker_count; ++i)
+	{
+		job_worker_t* worker = &jobs->workers[i];
+		worker->jobs = jobs;
+		worker->index = i;
+		worker->thread_fiber = NULL;
+		worker->pending_free = NULL;
+		worker->pending_wait = NULL;
+		worker->pending_counter = NULL;
+		worker->top = 0;
+		worker->bottom = 0;
+	}
+	for (int i = 0; i < worker_count; ++i)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "job worker %d", i);
+		jobs->workers[i].thread = thread_create_ex(job_worker_func, &jobs->workers[i], name, 0, k_thread_priority_normal, 0);
+	}
+	return jobs;
+}
+
+void job_system_destroy(job_system_t* jobs)
+{
+	atomic_store32(&jobs->running, 0, k_atomic_seq_cst);
+	atomic_fetch_add32(&jobs->signal, 1, k_atomic_seq_cst);
+	WakeByAddressAll((PVOID)&jobs->signal);
+	for (int i = 0; i < jobs->worker_count; ++i)
+	{
+		thread_destroy(jobs->workers[i].thread);
+	}
+
+	for (int i = 0; i < k_job_fiber_count; ++i)
+	{
+		DeleteFiber(jobs->fibers[i].fiber);
+	}
+	heap_free(jobs->heap, jobs->fibers);
+	queue_destroy(jobs->ready_fibers);
+	queue_destroy(jobs->free_fibers);
+
+	TlsFree(jobs->worker_tls);
+	queue_destroy(jobs->shared_queue);
+	object_pool_destroy(jobs->counter_pool);
+	object_pool_destroy(jobs->job_pool);
+	heap_free(jobs->heap, jobs->workers);
+	heap_free(jobs->heap, jobs);
+}
+
+int job_system_get_worker_count(job_system_t* jobs)
+{
+	return jobs->worker_count;
+}
+
+job_counter_t* job_counter_create(job_system_t* jobs)
+{
+	job_counter_t* counter = object_pool_get(jobs->counter_pool);
+	counter->jobs = jobs;
+	counter->value = 0;
+	counter->lock = 0;
+	counter->waiters = NULL;
+	return counter;
+}
+
+void job_counter_destroy(job_system_t* jobs, job_counter_t* counter)
+{
+	object_pool_put(jobs->counter_pool, counter);
+}
+
+int job_counter_get(job_counter_t* counter)
+{
+	return atomic_load32(&counter->value, k_atomic_acquire);
+}
+
+void job_run(job_system_t* jobs, void (*function)(void*), void* data, job_counter_t* counter)
+{
+	job_t* job = object_pool_get(jobs->job_pool);
+	job->function = function;
+	job->data = data;
+	job->counter = counter;
+	if (counter)
+	{
+		atomic_fetch_add32(&counter->value, 1, k_atomic_relaxed);
+	}
+
+	job_worker_t* worker = TlsGetValue(jobs->worker_tls);
+	if (!worker || !job_deque_push(worker, job))
+	{
+		queue_push(jobs->shared_queue, job);
+	}
+	job_wake(jobs);
+}
+
+void job_wait(job_system_t* jobs, job_counter_t* counter)
+{
+	job_worker_t* worker = TlsGetValue(jobs->worker_tls);
+	if (worker && atomic_load32(&counter->value, k_atomic_acquire) > 0)
+	{
+		// Park this fiber on the counter and let the worker carry on with another.
+		// We come back here once the counter has reached zero.
+		job_fiber_t* next = queue_try_pop(jobs->free_fibers);
+		if (next)
+		{
+			worker->pending_wait = GetFiberData();
+			worker->pending_counter = counter;
+			job_switch(jobs, next);
+			return;
+		}
+	}
+
+	// Not on a worker, or out of fibers: help out until the counter hits zero.
+	// The lock is held briefly after the final decrement; wait for it too
+	// so the caller can safely destroy the counter when we return.
+	while (atomic_load32(&counter->value, k_atomic_acquire) > 0 || atomic_load32(&counter->lock, k_atomic_acquire))
+	{
+		job_t* job = job_find(jobs, worker);
+		if (job)
+		{
+			job_execute(jobs, job);
+			continue;
+		}
+
+		// Nothing to help with. Sleep until the counter hits zero,
+		// waking now and then in case new jobs show up.
+		int value = atomic_load32(&counter->value, k_atomic_relaxed);
+		if (value > 0)
+		{
+			WaitOnAddress(&counter->value, &value, sizeof(value), k_job_wait_poll_ms);
+		}
+		else
+		{
+			YieldProcessor();
+		}
+	}
+}
+
+void job_wait_fs_work(job_system_t* jobs, fs_work_t* work)
+{
+	job_counter_t* counter = job_counter_create(jobs);
+	counter->value = 1;
+	if (fs_work_notify(work, job_fs_work_done, counter))
+	{
+		job_wait(jobs, counter);
+	}
+	job_counter_destroy(jobs, counter);
+	fs_work_wait(work);
+}
+
+static int job_worker_func(void* user)
+{
+	job_worker_t* worker = user;
+	job_system_t* jobs = worker->jobs;
+	TlsSetValue(jobs->worker_tls, worker);
+
+	// Jobs only ever run on pool fibers. The thread's own fiber
+	// just hands over to one and waits for shutdown.
+	worker->thread_fiber = ConvertThreadToFiber(NULL);
+	job_fiber_t* fiber = queue_pop(jobs->free_fibers);
+	SwitchToFiber(fiber->fiber);
+	job_after_switch(worker);
+	ConvertFiberToThread();
+
+	TlsSetValue(jobs->worker_tls, NULL);
+	return 0;
+}
+
+static void WINAPI job_fiber_func(void* user)
+{
+	job_fiber_t* self = user;
+	job_after_switch(TlsGetValue(self->jobs->worker_tls));
+	job_schedule(self->jobs, self);
+}
+
+// Main loop of a pool fiber. Never returns: on shutdown the fiber
+// switches back to its worker's thread fiber and is never resumed.
+static void job_schedule(job_system_t* jobs, job_fiber_t* self)
+{
+	int idle_count = 0;
+	while (true)
+	{
+		// Re-read the worker every time round; after a switch
+		// this fiber may be running on a different thread.
+		job_worker_t* worker = TlsGetValue(jobs->worker_tls);
+		if (!atomic_load32(&jobs->running, k_atomic_relaxed))
+		{
+			worker->pending_free = self;
+			SwitchToFiber(worker->thread_fiber);
+			continue;
+		}
+
+		// Resuming a waiting job takes priority over starting a new one.
+		job_fiber_t* ready = queue_try_pop(jobs->ready_fibers);
+		if (ready)
+		{
+			worker->pending_free = self;
+			job_switch(jobs, ready);
+			idle_count = 0;
+			continue;
+		}
+
+		job_t* job = job_find(jobs, worker);
+		if (job)
+		{
+			job_execute(jobs, job);
+			idle_count = 0;
+			continue;
+		}
+
+		if (++idle_count < k_job_spin_count)
+		{
+			YieldProcessor();
+			continue;
+		}
+		idle_count = 0;
+
+		// Register as a sleeper, then force every other thread's pending stores out.
+		// Either the search below sees a job or fiber pushed before that point,
+		// or the pusher sees sleepers is non-zero and bumps the signal.
+		atomic_fetch_add32(&jobs->sleepers, 1, k_atomic_seq_cst);
+		int signal = atomic_load32(&jobs->signal, k_atomic_relaxed);
+		FlushProcessWriteBuffers();
+		ready = queue_try_pop(jobs->ready_fibers);
+		job = ready ? NULL : job_find(jobs, worker);
+		if (!ready && !job && atomic_load32(&jobs->running, k_atomic_relaxed))
+		{
+			WaitOnAddress(&jobs->signal, &signal, sizeof(signal), INFINITE);
+		}
+		atomic_fetch_add32(&jobs->sleepers, -1, k_atomic_relaxed);
+
+		if (ready)
+		{
+			worker->pending_free = self;
+			job_switch(jobs, ready);
+		}
+		else if (job)
+		{
+			job_execute(jobs, job);
+		}
+	}
+}
+
+static void job_switch(job_system_t* jobs, job_fiber_t* fiber)
+{
+	SwitchToFiber(fiber->fiber);
+	job_after_switch(TlsGetValue(jobs->worker_tls));
+}
+
+static void job_after_switch(job_worker_t* worker)
+{
+	job_system_t* jobs = worker->jobs;
+	if (worker->pending_free)
+	{
+		queue_push(jobs->free_fibers, worker->pending_free);
+		worker->pending_free = NULL;
+	}
+
+	if (worker->pending_wait)
+	{
+		job_fiber_t* fiber = worker->pending_wait;
+		job_counter_t* counter = worker->pending_counter;
+		worker->pending_wait = NULL;
+		worker->pending_counter = NULL;
+
+		job_counter_lock(counter);
+		if (atomic_load32(&counter->value, k_atomic_relaxed) > 0)
+		{
+			fiber->next = counter->waiters;
+			counter->waiters = fiber;
+			fiber = NULL;
+		}
+		job_counter_unlock(counter);
+
+		if (fiber)
+		{
+			// The counter reached zero while the fiber was switching out.
+			job_ready(jobs, fiber);
+		}
+	}
+}
+
+static void job_ready(job_system_t* jobs, job_fiber_t* fiber)
+{
+	queue_push(jobs->ready_fibers, fiber);
+	job_wake(jobs);
+}
+
+static void job_wake(job_system_t* jobs)
+{
+	// See job_schedule for why a plain read of sleepers is enough.
+	if (atomic_load32(&jobs->sleepers, k_atomic_relaxed))
+	{
+		atomic_fetch_add32(&jobs->signal, 1, k_atomic_seq_cst);
+		WakeByAddressSingle((PVOID)&jobs->signal);
+	}
+}
+
+static void job_counter_decrement(job_counter_t* counter)
+{
+	// Decrements that leave the counter above zero need no lock.
+	int value = atomic_load32(&counter->value, k_atomic_relaxed);
+	while (value > 1)
+	{
+		int previous = atomic_compare_exchange32(&counter->value, value, value - 1, k_atomic_release);
+		if (previous == value)
+		{
+			return;
+		}
+		value = previous;
+	}
+
+	// Once unlocked at zero the counter may be destroyed; read what we need first.
+	job_system_t* jobs = counter->jobs;
+	job_counter_lock(counter);
+	job_fiber_t* waiters = NULL;
+	if (atomic_fetch_add32(&counter->value, -1, k_atomic_release) == 1)
+	{
+		waiters = counter->waiters;
+		counter->waiters = NULL;
+	}
+	job_counter_unlock(counter);
+
+	WakeByAddressAll((PVOID)&counter->value);
+	while (waiters)
+	{
+		job_fiber_t* next = waiters->next;
+		job_ready(jobs, waiters);
+		waiters = next;
+	}
+}
+
+static void job_counter_lock(job_counter_t* counter)
+{
+	while (atomic_compare_exchange32(&counter->lock, 0, 1, k_atomic_acquire) != 0)
+	{
+		YieldProcessor();
+	}
+}
+
+static void job_counter_unlock(job_counter_t* counter)
+{
+	atomic_store32(&counter->lock, 0, k_atomic_release);
+}
+
+static void job_fs_work_done(void* user)
+{
+	job_counter_decrement(user);
+}
+
+static job_t* job_find(job_system_t* jobs, job_worker_t* worker)
+{
+	job_t* job = worker ? job_deque_pop(worker) : NULL;
+	if (job)
+	{
+		return job;
+	}
+
+	job = queue_try_pop(jobs->shared_queue);
+	if (job)
+	{
+		return job;
+	}
+
+	// Start with the next worker over so thieves spread across victims.
+	int start = worker ? worker->index + 1 : 0;
+	for (int i = 0; i < jobs->worker_count; ++i)
+	{
+		job_worker_t* victim = &jobs->workers[(start + i) % jobs->worker_count];
+		if (victim == worker)
+		{
+			continue;
+		}
+		job = job_deque_steal(victim);
+		if (job)
+		{
+			return job;
+		}
+	}
+	return NULL;
+}
+
+static void job_execute(job_system_t* jobs, job_t* job)
+{
+	job->function(job->data);
+
+	job_counter_t* counter = job->counter;
+	object_pool_put(jobs->job_pool, job);
+
+	if (counter)
+	{
+		job_counter_decrement(counter);
+	}
+}
+
+static bool job_deque_push(job_worker_t* worker, job_t* job)
+{
+	int64_t bottom = atomic_load64(&worker->bottom, k_atomic_relaxed);
+	int64_t top = atomic_load64(&worker->top, k_atomic_acquire);
+	if (bottom - top >= k_job_deque_capacity)
+	{
+		return false;
+	}
+	worker->deque[bottom & (k_job_deque_capacity - 1)] = job;
+	atomic_store64(&worker->bottom, bottom + 1, k_atomic_release);
+	return true;
+}
+
+static job_t* job_deque_pop(job_worker_t* worker)
+{
+	// Claim the bottom slot before looking at top; the seq_cst store is a full barrier
+	// so a concurrent thief either sees the claim or we see its steal.
+	int64_t bottom = atomic_load64(&worker->bottom, k_atomic_relaxed) - 1;
+	atomic_store64(&worker->bottom, bottom, k_atomic_seq_cst);
+	int64_t top = atomic_load64(&worker->top, k_atomic_relaxed);
+	if (top > bottom)
+	{
+		atomic_store64(&worker->bottom, bottom + 1, k_atomic_relaxed);
+		return NULL;
+	}
+
+	job_t* job = worker->deque[bottom & (k_job_deque_capacity - 1)];
+	if (top == bottom)
+	{
+		// Last job: race thieves for it.
+		if (atomic_compare_exchange64(&worker->top, top, top + 1, k_atomic_seq_cst) != top)
+		{
+			job = NULL;
+		}
+		atomic_store64(&worker->bottom, bottom + 1, k_atomic_relaxed);
+	}
+	return job;
+}
+
+static job_t* job_deque_steal(job_worker_t* victim)
+{
+	int64_t top = atomic_load64(&victim->top, k_atomic_acquire);
+	atomic_fence(k_atomic_seq_cst);
+	int64_t bottom = atomic_load64(&victim->bottom, k_atomic_acquire);
+	if (top >= bottom)
+	{
+		return NULL;
+	}
+
+	job_t* job = victim->deque[top & (k_job_deque_capacity - 1)];
+	if (atomic_compare_exchange64(&victim->top, top, top + 1, k_atomic_seq_cst) != top)
+	{
+		return NULL;
+	}
+	return job;
+}
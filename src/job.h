@@ -0,0 +1,59 @@
+#pragma once
+
+// Work-stealing job system
+//
+// Main object, job_system_t, owns a pool of worker threads, each with its own deque of jobs.
+// Workers run jobs from the back of their own deque and steal from the front of others'.
+// Jobs queued from threads that are not workers go through a shared queue.
+// Completion is tracked with counters: each job queued against a counter increments it,
+// and the counter is decremented when the job finishes.
+// Jobs run on fibers. A job that waits on a counter or file work from inside a worker
+// yields its fiber and the worker moves on to other jobs until the wait is over.
+
+// Handle to a job system.
+typedef struct job_system_t job_system_t;
+
+// Handle to a job completion counter.
+typedef struct job_counter_t job_counter_t;
+
+typedef struct fs_work_t fs_work_t;
+typedef struct heap_t heap_t;
+
+// Create a job system with the given number of worker threads.
+// If worker_count is zero or less, one worker is created per logical core,
+// less one for the calling thread which helps out in job_wait.
+job_system_t* job_system_create(heap_t* heap, int worker_count);
+
+// Destroy a job system.
+// Queued jobs that have not yet started are dropped; wait on their counters first.
+void job_system_destroy(job_system_t* jobs);
+
+// Get the number of worker threads in a job system.
+int job_system_get_worker_count(job_system_t* jobs);
+
+// Create a counter with a value of zero.
+job_counter_t* job_counter_create(job_system_t* jobs);
+
+// Destroy a counter. No jobs may still be queued against it.
+void job_counter_destroy(job_system_t* jobs, job_counter_t* counter);
+
+// Get the number of jobs queued against a counter that have not completed.
+int job_counter_get(job_counter_t* counter);
+
+// Queue a job to call function with data on some worker thread.
+// If counter is not NULL, it is incremented now and decremented when the job completes.
+// Safe to call from any thread, including from inside a job.
+void job_run(job_system_t* jobs, void (*function)(void*), void* data, job_counter_t* counter);
+
+// Wait for a counter to reach zero.
+// Called from a job, the job is suspended and resumed once the counter reaches zero,
+// possibly on a different worker thread.
+// Called from any other thread, the thread runs other queued jobs while waiting.
+// Do not hold a lock across the wait. Jobs run meanwhile on the same thread's stack,
+// as when not on a worker or out of fibers, would re-enter a recursive mutex_t; jobs on
+// other fibers block their workers on it, and with enough of them none is left to finish.
+void job_wait(job_system_t* jobs, job_counter_t* counter);
+
+// Wait for file work to complete.
+// Suspends the calling job like job_wait instead of blocking its worker.
+void job_wait_fs_work(job_system_t* jobs, fs_work_t* work);
@@ -0,0 +1,220 @@
+#include "job_bench.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "heap.h"
+#include "job.h"
+#include "timer.h"
+
+#include <stdint.h>
+
+enum
+{
+	// Empty jobs queued from the calling thread.
+	k_job_bench_empty_jobs = 100000,
+
+	// Depth of the spawn tree; it has 2^depth leaves.
+	k_job_bench_tree_depth = 16,
+
+	// Elements summed by the parallel sum, and the elements per job.
+	k_job_bench_sum_elements = 16 * 1024 * 1024,
+	k_job_bench_sum_chunk = 16 * 1024,
+
+	k_job_bench_max_threads = 64,
+};
+
+// State shared by the jobs of one run.
+typedef struct job_bench_run_t
+{
+	job_system_t* jobs;
+	volatile int leaf_count;
+
+	const uint32_t* elements;
+	uint64_t sums[k_job_bench_sum_elements / k_job_bench_sum_chunk];
+} job_bench_run_t;
+
+// A job in the spawn tree, or a chunk of the parallel sum.
+typedef struct job_bench_node_t
+{
+	job_bench_run_t* run;
+	int depth;
+	int index;
+} job_bench_node_t;
+
+typedef struct job_bench_t
+{
+	const char* name;
+	uint64_t (*function)(job_bench_run_t* run);
+} job_bench_t;
+
+static void job_bench_run_one(heap_t* heap, const job_bench_t* bench, int worker_count, const uint32_t* elements);
+static uint64_t job_bench_empty(job_bench_run_t* run);
+static uint64_t job_bench_tree(job_bench_run_t* run);
+static uint64_t job_bench_sum(job_bench_run_t* run);
+static void job_bench_empty_func(void* user);
+static void job_bench_tree_func(void* user);
+static void job_bench_sum_func(void* user);
+
+void job_bench_run(int max_threads)
+{
+	if (max_threads < 1)
+	{
+		max_threads = 1;
+	}
+	if (max_threads > k_job_bench_max_threads)
+	{
+		max_threads = k_job_bench_max_threads;
+	}
+
+	heap_t* heap = heap_create(2 * 1024 * 1024);
+	uint32_t* elements = heap_alloc(heap, sizeof(uint32_t) * k_job_bench_sum_elements, 64);
+	for (int i = 0; i < k_job_bench_sum_elements; ++i)
+	{
+		elements[i] = (uint32_t)i * 2654435761u;
+	}
+
+	debug_print(k_print_info, "benchmark,threads,ops_per_sec,ns_per_op\n");
+
+	job_bench_t benches[] =
+	{
+		{ "job_empty", job_bench_empty },
+		{ "job_spawn_tree", job_bench_tree },
+		{ "job_parallel_sum", job_bench_sum },
+	};
+	for (int i = 0; i < _countof(benches); ++i)
+	{
+		for (int worker_count = 1; ; worker_count *= 2)
+		{
+			if (worker_count > max_threads)
+			{
+				worker_count = max_threads;
+			}
+			job_bench_run_one(heap, &benches[i], worker_count, elements);
+			if (worker_count == max_threads)
+			{
+				break;
+			}
+		}
+	}
+
+	heap_free(heap, elements);
+	heap_destroy(heap);
+}
+
+static void job_bench_run_one(heap_t* heap, const job_bench_t* bench, int worker_count, const uint32_t* elements)
+{
+	job_bench_run_t* run = heap_alloc(heap, sizeof(job_bench_run_t), 64);
+	run->jobs = job_system_create(heap, worker_count);
+	run->leaf_count = 0;
+	run->elements = elements;
+
+	uint64_t start_ticks = timer_get_ticks();
+	uint64_t op_count = bench->function(run);
+	uint64_t duration_ticks = timer_get_ticks() - start_ticks;
+
+	double seconds = (double)duration_ticks / timer_get_ticks_per_second();
+	double ops_per_second = seconds > 0.0 ? (double)op_count / seconds : 0.0;
+	double ns_per_op = op_count ? seconds * 1000000000.0 / (double)op_count : 0.0;
+	debug_print(k_print_info, "%s,%d,%.0f,%.1f\n", bench->name, worker_count, ops_per_second, ns_per_op);
+
+	job_system_destroy(run->jobs);
+	heap_free(heap, run);
+}
+
+static uint64_t job_bench_empty(job_bench_run_t* run)
+{
+	// Jobs from outside the pool go through the shared queue and wake sleeping workers.
+	job_counter_t* counter = job_counter_create(run->jobs);
+	for (int i = 0; i < k_job_bench_empty_jobs; ++i)
+	{
+		job_run(run->jobs, job_bench_empty_func, NULL, counter);
+	}
+	job_wait(run->jobs, counter);
+	job_counter_destroy(run->jobs, counter);
+	return k_job_bench_empty_jobs;
+}
+
+static uint64_t job_bench_tree(job_bench_run_t* run)
+{
+	// Every inner job pushes its children onto its worker's deque and parks its fiber
+	// until they finish, so idle workers have to steal to get going.
+	job_bench_node_t root = { .run = run, .depth = k_job_bench_tree_depth };
+	job_counter_t* counter = job_counter_create(run->jobs);
+	job_run(run->jobs, job_bench_tree_func, &root, counter);
+	job_wait(run->jobs, counter);
+	job_counter_destroy(run->jobs, counter);
+
+	int leaf_count = atomic_load32(&run->leaf_count, k_atomic_acquire);
+	if (leaf_count != 1 << k_job_bench_tree_depth)
+	{
+		debug_print(k_print_error, "job_spawn_tree finished %d leaves, expected %d!\n",
+			leaf_count, 1 << k_job_bench_tree_depth);
+	}
+	return (2ull << k_job_bench_tree_depth) - 1;
+}
+
+static uint64_t job_bench_sum(job_bench_run_t* run)
+{
+	job_bench_node_t nodes[k_job_bench_sum_elements / k_job_bench_sum_chunk];
+	job_counter_t* counter = job_counter_create(run->jobs);
+	for (int i = 0; i < _countof(nodes); ++i)
+	{
+		nodes[i] = (job_bench_node_t){ .run = run, .index = i };
+		job_run(run->jobs, job_bench_sum_func, &nodes[i], counter);
+	}
+	job_wait(run->jobs, counter);
+	job_counter_destroy(run->jobs, counter);
+
+	uint64_t sum = 0;
+	for (int i = 0; i < _countof(nodes); ++i)
+	{
+		sum += run->sums[i];
+	}
+	uint64_t expected = 0;
+	for (int i = 0; i < k_job_bench_sum_elements; ++i)
+	{
+		expected += run->elements[i];
+	}
+	if (sum != expected)
+	{
+		debug_print(k_print_error, "job_parallel_sum got %llu, expected %llu!\n", sum, expected);
+	}
+	return k_job_bench_sum_elements;
+}
+
+static void job_bench_empty_func(void* user)
+{
+}
+
+static void job_bench_tree_func(void* user)
+{
+	job_bench_node_t* node = user;
+	if (node->depth == 0)
+	{
+		atomic_fetch_add32(&node->run->leaf_count, 1, k_atomic_relaxed);
+		return;
+	}
+
+	job_bench_node_t children[2] =
+	{
+		{ .run = node->run, .depth = node->depth - 1 },
+		{ .run = node->run, .depth = node->depth - 1 },
+	};
+	job_counter_t* counter = job_counter_create(node->run->jobs);
+	job_run(node->run->jobs, job_bench_tree_func, &children[0], counter);
+	job_run(node->run->jobs, job_bench_tree_func, &children[1], counter);
+	job_wait(node->run->jobs, counter);
+	job_counter_destroy(node->run->jobs, counter);
+}
+
+static void job_bench_sum_func(void* user)
+{
+	job_bench_node_t* node = user;
+	const uint32_t* elements = &node->run->elements[node->index * k_job_bench_sum_chunk];
+	uint64_t sum = 0;
+	for (int i = 0; i < k_job_bench_sum_chunk; ++i)
+	{
+		sum += elements[i];
+	}
+	node->run->sums[node->index] = sum;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// Job system benchmarks.
+
+// Runs every job system benchmark:
+// empty jobs queued from a non-worker thread, a tree of jobs that each spawn and wait on
+// their children, and a parallel sum split into chunks.
+// Worker counts go 1, 2, 4, ... up to max_threads.
+// Results are printed as one CSV row per run: benchmark, worker count,
+// jobs (or elements summed) per second and wall time per job or element.
+void job_bench_run(int max_threads);
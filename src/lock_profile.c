@@ -0,0 +1,233 @@
+#include "lock_profile.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	// Distinct lock names that can be tracked.
+	k_lock_profile_site_capacity = 256,
+
+	k_lock_profile_label_size = 64,
+};
+
+// Counters are bumped with relaxed atomics from every thread using the lock.
+typedef struct lock_profile_site_t
+{
+	const char* name;
+	char wait_label[k_lock_profile_label_size];
+	volatile int64_t acquire_count;
+	volatile int64_t contention_count;
+	volatile int64_t wait_ticks;
+	volatile int64_t max_wait_ticks;
+	volatile int64_t hold_ticks;
+	volatile int64_t max_hold_ticks;
+	volatile int64_t wait_histogram[k_lock_profile_histogram_buckets];
+} lock_profile_site_t;
+
+// Locks are created before any heap exists, and the heap itself is locked,
+// so the profiler keeps its state in static storage guarded by a tiny spinlock.
+static lock_profile_site_t s_sites[k_lock_profile_site_capacity];
+static volatile int s_site_count = 0;
+static volatile int s_site_lock = 0;
+static volatile int s_enabled = 0;
+static trace_t* volatile s_trace = NULL;
+
+static void lock_profile_update_max(volatile int64_t* address, int64_t value);
+static int lock_profile_compare_wait(const void* a, const void* b);
+
+void lock_profile_set_enabled(bool enabled)
+{
+	atomic_store32(&s_enabled, enabled ? 1 : 0, k_atomic_relaxed);
+}
+
+bool lock_profile_is_enabled()
+{
+	return atomic_load32(&s_enabled, k_atomic_relaxed) != 0;
+}
+
+void lock_profile_set_trace(trace_t* trace)
+{
+	atomic_store_ptr((void* volatile*)&s_trace, trace, k_atomic_release);
+}
+
+lock_profile_site_t* lock_profile_site_get(const char* name)
+{
+	while (atomic_compare_exchange32(&s_site_lock, 0, 1, k_atomic_acquire) != 0)
+	{
+		YieldProcessor();
+	}
+
+	lock_profile_site_t* site = NULL;
+	for (int i = 0; i < s_site_count; ++i)
+	{
+		if (strcmp(s_sites[i].name, name) == 0)
+		{
+			site = &s_sites[i];
+			break;
+		}
+	}
+	if (!site && s_site_count < k_lock_profile_site_capacity)
+	{
+		site = &s_sites[s_site_count];
+		site->name = name;
+		snprintf(site->wait_label, sizeof(site->wait_label), "lock wait: %s", name);
+		atomic_store32(&s_site_count, s_site_count + 1, k_atomic_release);
+	}
+
+	atomic_store32(&s_site_lock, 0, k_atomic_release);
+
+	if (!site)
+	{
+		debug_print(k_print_warning, "Lock profiler out of sites, %s will not be tracked!\n", name);
+	}
+	return site;
+}
+
+void lock_profile_record_acquire(lock_profile_site_t* site, uint64_t wait_ticks, bool contended)
+{
+	if (!site)
+	{
+		return;
+	}
+
+	atomic_fetch_add64(&site->acquire_count, 1, k_atomic_relaxed);
+	if (!contended)
+	{
+		atomic_fetch_add64(&site->wait_histogram[0], 1, k_atomic_relaxed);
+		return;
+	}
+
+	atomic_fetch_add64(&site->contention_count, 1, k_atomic_relaxed);
+	atomic_fetch_add64(&site->wait_ticks, (int64_t)wait_ticks, k_atomic_relaxed);
+	lock_profile_update_max(&site->max_wait_ticks, (int64_t)wait_ticks);
+
+	uint64_t us = timer_ticks_to_us(wait_ticks);
+	int bucket = 0;
+	while (us && bucket < k_lock_profile_histogram_buckets - 1)
+	{
+		us >>= 1;
+		++bucket;
+	}
+	atomic_fetch_add64(&site->wait_histogram[bucket], 1, k_atomic_relaxed);
+}
+
+void lock_profile_record_hold(lock_profile_site_t* site, uint64_t hold_ticks)
+{
+	if (!site)
+	{
+		return;
+	}
+	atomic_fetch_add64(&site->hold_ticks, (int64_t)hold_ticks, k_atomic_relaxed);
+	lock_profile_update_max(&site->max_hold_ticks, (int64_t)hold_ticks);
+}
+
+void lock_profile_wait_begin(lock_profile_site_t* site)
+{
+	trace_t* trace = atomic_load_ptr((void* volatile*)&s_trace, k_atomic_acquire);
+	if (trace && site)
+	{
+		trace_duration_push(trace, site->wait_label);
+	}
+}
+
+void lock_profile_wait_end(lock_profile_site_t* site)
+{
+	trace_t* trace = atomic_load_ptr((void* volatile*)&s_trace, k_atomic_acquire);
+	if (trace && site)
+	{
+		trace_duration_pop(trace);
+	}
+}
+
+int lock_profile_get_stats(lock_stats_t* stats, int capacity)
+{
+	int count = __min(atomic_load32(&s_site_count, k_atomic_acquire), capacity);
+	for (int i = 0; i < count; ++i)
+	{
+		lock_profile_site_t* site = &s_sites[i];
+		lock_stats_t* out = &stats[i];
+		out->name = site->name;
+		out->acquire_count = atomic_load64(&site->acquire_count, k_atomic_relaxed);
+		out->contention_count = atomic_load64(&site->contention_count, k_atomic_relaxed);
+		out->wait_us = timer_ticks_to_us(atomic_load64(&site->wait_ticks, k_atomic_relaxed));
+		out->max_wait_us = timer_ticks_to_us(atomic_load64(&site->max_wait_ticks, k_atomic_relaxed));
+		out->hold_us = timer_ticks_to_us(atomic_load64(&site->hold_ticks, k_atomic_relaxed));
+		out->max_hold_us = timer_ticks_to_us(atomic_load64(&site->max_hold_ticks, k_atomic_relaxed));
+		for (int b = 0; b < k_lock_profile_histogram_buckets; ++b)
+		{
+			out->wait_histogram[b] = atomic_load64(&site->wait_histogram[b], k_atomic_relaxed);
+		}
+	}
+	return count;
+}
+
+void lock_profile_reset()
+{
+	int count = atomic_load32(&s_site_count, k_atomic_acquire);
+	for (int i = 0; i < count; ++i)
+	{
+		lock_profile_site_t* site = &s_sites[i];
+		atomic_store64(&site->acquire_count, 0, k_atomic_relaxed);
+		atomic_store64(&site->contention_count, 0, k_atomic_relaxed);
+		atomic_store64(&site->wait_ticks, 0, k_atomic_relaxed);
+		atomic_store64(&site->max_wait_ticks, 0, k_atomic_relaxed);
+		atomic_store64(&site->hold_ticks, 0, k_atomic_relaxed);
+		atomic_store64(&site->max_hold_ticks, 0, k_atomic_relaxed);
+		for (int b = 0; b < k_lock_profile_histogram_buckets; ++b)
+		{
+			atomic_store64(&site->wait_histogram[b], 0, k_atomic_relaxed);
+		}
+	}
+}
+
+void lock_profile_print()
+{
+	lock_stats_t stats[k_lock_profile_site_capacity];
+	int count = lock_profile_get_stats(stats, k_lock_profile_site_capacity);
+	qsort(stats, count, sizeof(stats[0]), lock_profile_compare_wait);
+
+	debug_print(k_print_info, "Lock contention (times in us):\n");
+	for (int i = 0; i < count; ++i)
+	{
+		lock_stats_t* s = &stats[i];
+		if (!s->contention_count)
+		{
+			continue;
+		}
+		debug_print(k_print_info,
+			"  %-24s acquires %llu contended %llu wait %llu (max %llu) hold %llu (max %llu)\n",
+			s->name, s->acquire_count, s->contention_count,
+			s->wait_us, s->max_wait_us, s->hold_us, s->max_hold_us);
+	}
+}
+
+static void lock_profile_update_max(volatile int64_t* address, int64_t value)
+{
+	int64_t current = atomic_load64(address, k_atomic_relaxed);
+	while (value > current)
+	{
+		int64_t previous = atomic_compare_exchange64(address, current, value, k_atomic_relaxed);
+		if (previous == current)
+		{
+			break;
+		}
+		current = previous;
+	}
+}
+
+static int lock_profile_compare_wait(const void* a, const void* b)
+{
+	const lock_stats_t* sa = a;
+	const lock_stats_t* sb = b;
+	return sa->wait_us < sb->wait_us ? 1 : sa->wait_us > sb->wait_us ? -1 : 0;
+}
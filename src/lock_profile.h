@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Lock contention profiler
+//
+// Opt-in instrumentation for mutex_t and semaphore_t.
+// While enabled, every lock records how long threads waited to acquire it,
+// how long it was held and how often an acquire found it taken.
+// Statistics are kept per lock name: all locks created with the same name
+// are reported together. Disabled, the cost is one flag check per operation.
+
+typedef struct trace_t trace_t;
+
+enum
+{
+	// Wait time histogram buckets. Bucket 0 counts waits under a microsecond,
+	// bucket n waits of [2^(n-1), 2^n) microseconds; the last bucket takes the rest.
+	k_lock_profile_histogram_buckets = 20,
+};
+
+// Handle to the statistics for one lock name.
+typedef struct lock_profile_site_t lock_profile_site_t;
+
+// Snapshot of the statistics for one lock name.
+// Times are in microseconds.
+// Semaphores are usually released by a different thread than acquired them,
+// so they record no hold time.
+typedef struct lock_stats_t
+{
+	const char* name;
+	uint64_t acquire_count;
+	uint64_t contention_count;
+	uint64_t wait_us;
+	uint64_t max_wait_us;
+	uint64_t hold_us;
+	uint64_t max_hold_us;
+	uint64_t wait_histogram[k_lock_profile_histogram_buckets];
+} lock_stats_t;
+
+// Turn recording on or off for all locks.
+void lock_profile_set_enabled(bool enabled);
+
+// Determine if recording is on.
+bool lock_profile_is_enabled();
+
+// Emit a trace duration named "lock wait: <name>" for every contended acquire.
+// Pass NULL to stop.
+void lock_profile_set_trace(trace_t* trace);
+
+// Find or create the statistics for a lock name.
+// Used by the synchronization primitives; the name must outlive the process.
+lock_profile_site_t* lock_profile_site_get(const char* name);
+
+// Record an acquire of a lock that took wait_ticks timer ticks.
+// A contended acquire is one that had to wait for another thread.
+void lock_profile_record_acquire(lock_profile_site_t* site, uint64_t wait_ticks, bool contended);
+
+// Record a release of a lock held for hold_ticks timer ticks.
+void lock_profile_record_hold(lock_profile_site_t* site, uint64_t hold_ticks);
+
+// Begin and end the trace duration around a contended acquire.
+void lock_profile_wait_begin(lock_profile_site_t* site);
+void lock_profile_wait_end(lock_profile_site_t* site);
+
+// Copy statistics for up to capacity lock names into stats.
+// Returns the number of entries written.
+int lock_profile_get_stats(lock_stats_t* stats, int capacity);
+
+// Zero all statistics.
+void lock_profile_reset();
+
+// Print statistics for every lock that has been contended, most total wait time first.
+void lock_profile_print();
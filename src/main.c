@@ -3,7 +3,9 @@
 #include "heap.h"
 #include "render.h"
 #include "simple_game.h"
+#include "thread.h"
 #include "timer.h"
+#include "trace.h"
 #include "wm.h"
 
 #include "cpp_test.h"
@@ -15,14 +17,30 @@ int main(int argc, const char* argv[])
 
 	timer_startup();
 
+	// Keep the game and render threads on separate physical cores; see render_create.
+	thread_configure_current("game", thread_get_core_affinity(0), k_thread_priority_normal);
+
 	cpp_test_function(42);
 
-	heap_t* heap = heap_create(2 * 1024 * 1024);
+	heap_info_t heap_info =
+	{
+		.grow_increment = 2 * 1024 * 1024,
+		.reserve_size = 1024 * 1024 * 1024,
+		.large_pages = true,
+	};
+	heap_t* heap = heap_create_ex(&heap_info);
 	fs_t* fs = fs_create(heap, 8);
+	trace_t* trace = trace_create(heap, 64 * 1024);
 	wm_window_t* window = wm_create(heap);
-	render_t* render = render_create(heap, window);
+	render_t* render = render_create(heap, window, trace);
+
+	simple_game_t* game = simple_game_create(heap, fs, window, render, trace, argc, argv);
 
-	simple_game_t* game = simple_game_create(heap, fs, window, render, argc, argv);
+	// Optional second argument streams a binary capture; see ga2022_trace_convert.
+	if (argc >= 3)
+	{
+		trace_capture_start_ex(trace, argv[2], k_trace_format_binary, fs, true);
+	}
 
 	while (!wm_pump(window))
 	{
@@ -35,6 +53,7 @@ int main(int argc, const char* argv[])
 	simple_game_destroy(game);
 
 	wm_destroy(window);
+	trace_destroy(trace);
 	fs_destroy(fs);
 	heap_destroy(heap);
 
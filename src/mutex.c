@@ -1,24 +1,156 @@
 #include "mutex.h"
 
+#include "atomic.h"
+#include "lock_profile.h"
+#include "timer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+enum
+{
+	// Lock states.
+	k_mutex_unlocked = 0,
+	k_mutex_locked = 1,
+	k_mutex_contended = 2,
+
+	// Attempts to take a held lock before parking the thread.
+	k_mutex_spin_count = 1024,
+};
+
+// User-space mutex.
+// Uncontended lock and unlock are a single interlocked operation each.
+// Waiters spin briefly, then park with WaitOnAddress on the state word.
+typedef struct mutex_t
+{
+	volatile int state;
+	void* volatile owner;
+	int recursion;
+
+	// Lock profiler statistics, and when the current owner took the lock
+	// if the profiler was on at the time.
+	lock_profile_site_t* profile_site;
+	uint64_t acquire_ticks;
+	bool hold_timed;
+} mutex_t;
+
+static void* mutex_get_owner();
+static void mutex_lock_profiled(mutex_t* mutex);
+static void mutex_lock_contended(mutex_t* mutex);
+
 mutex_t* mutex_create()
 {
-	return (mutex_t*)CreateMutex(NULL, FALSE, NULL);
+	return mutex_create_named("mutex");
+}
+
+mutex_t* mutex_create_named(const char* name)
+{
+	// The heap itself is guarded by a mutex, so mutexes come from the process heap.
+	mutex_t* mutex = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(mutex_t));
+	mutex->profile_site = lock_profile_site_get(name);
+	return mutex;
 }
 
 void mutex_destroy(mutex_t* mutex)
 {
-	CloseHandle(mutex);
+	HeapFree(GetProcessHeap(), 0, mutex);
 }
 
 void mutex_lock(mutex_t* mutex)
 {
-	WaitForSingleObject(mutex, INFINITE);
+	// Only the owner can ever observe its own id here.
+	void* owner = mutex_get_owner();
+	if (mutex->owner == owner)
+	{
+		++mutex->recursion;
+		return;
+	}
+
+	if (lock_profile_is_enabled())
+	{
+		mutex_lock_profiled(mutex);
+	}
+	else
+	{
+		if (atomic_compare_exchange32(&mutex->state, k_mutex_unlocked, k_mutex_locked, k_atomic_acquire) != k_mutex_unlocked)
+		{
+			mutex_lock_contended(mutex);
+		}
+		mutex->hold_timed = false;
+	}
+	mutex->owner = owner;
+	mutex->recursion = 1;
 }
 
 void mutex_unlock(mutex_t* mutex)
 {
-	ReleaseMutex(mutex);
+	if (--mutex->recursion > 0)
+	{
+		return;
+	}
+	mutex->owner = NULL;
+
+	if (mutex->hold_timed)
+	{
+		lock_profile_record_hold(mutex->profile_site, timer_get_ticks() - mutex->acquire_ticks);
+	}
+
+	if (atomic_exchange32(&mutex->state, k_mutex_unlocked, k_atomic_release) == k_mutex_contended)
+	{
+		WakeByAddressSingle((PVOID)&mutex->state);
+	}
+}
+
+static void* mutex_get_owner()
+{
+	// A job parked in job_wait leaves its worker thread free to run other jobs' fibers,
+	// so on fibers the fiber owns the lock, not the thread. Thread ids are tagged odd
+	// so they never match a fiber's address.
+	if (IsThreadAFiber())
+	{
+		return GetCurrentFiber();
+	}
+	return (void*)(((uintptr_t)GetCurrentThreadId() << 1) | 1);
+}
+
+static void mutex_lock_profiled(mutex_t* mutex)
+{
+	bool contended = atomic_compare_exchange32(&mutex->state, k_mutex_unlocked, k_mutex_locked, k_atomic_acquire) != k_mutex_unlocked;
+	uint64_t wait_ticks = 0;
+	if (contended)
+	{
+		uint64_t start = timer_get_ticks();
+		lock_profile_wait_begin(mutex->profile_site);
+		mutex_lock_contended(mutex);
+		lock_profile_wait_end(mutex->profile_site);
+		wait_ticks = timer_get_ticks() - start;
+	}
+	lock_profile_record_acquire(mutex->profile_site, wait_ticks, contended);
+	mutex->acquire_ticks = timer_get_ticks();
+	mutex->hold_timed = true;
+}
+
+static void mutex_lock_contended(mutex_t* mutex)
+{
+	for (int i = 0; i < k_mutex_spin_count; ++i)
+	{
+		if (atomic_load32(&mutex->state, k_atomic_relaxed) == k_mutex_unlocked &&
+			atomic_compare_exchange32(&mutex->state, k_mutex_unlocked, k_mutex_locked, k_atomic_acquire) == k_mutex_unlocked)
+		{
+			return;
+		}
+		YieldProcessor();
+	}
+
+	// Mark the lock contended so the owner wakes us on unlock.
+	// Once parked we cannot tell whether other waiters remain, so the lock is
+	// always taken back in the contended state.
+	int contended = k_mutex_contended;
+	while (atomic_exchange32(&mutex->state, k_mutex_contended, k_atomic_acquire) != k_mutex_unlocked)
+	{
+		WaitOnAddress(&mutex->state, &contended, sizeof(contended), INFINITE);
+	}
 }
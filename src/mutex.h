@@ -8,12 +8,17 @@ typedef struct mutex_t mutex_t;
 // Creates a new mutex.
 mutex_t* mutex_create();
 
+// Creates a new mutex with a name for the lock profiler.
+// Mutexes sharing a name are profiled together. See lock_profile.h.
+mutex_t* mutex_create_named(const char* name);
+
 // Destroys a previously created mutex.
 void mutex_destroy(mutex_t* mutex);
 
-// Locks a mutex. May block if another thread unlocks it.
+// Locks a mutex. Spins briefly, then blocks until another thread unlocks it.
 // If a thread locks a mutex multiple times, it must be unlocked
-// multiple times.
+// multiple times. Jobs running on fibers own the lock per fiber rather than
+// per thread; see job_wait for why a lock should not be held across it.
 void mutex_lock(mutex_t* mutex);
 
 // Unlocks a mutex.
@@ -1,11 +1,14 @@
 #include "net.h"
 
+#include "atomic.h"
 #include "debug.h"
 #include "heap.h"
-#include "mutex.h"
+#include "object_pool.h"
 #include "queue.h"
+#include "rwlock.h"
 #include "thread.h"
 #include "timer.h"
+#include "trace.h"
 
 #include <stdbool.h>
 
@@ -22,6 +25,7 @@ enum
 	k_max_entity_types = 32,
 	k_max_snapshots = 256,
 	k_max_entities = 32,
+	k_packet_pool_capacity = 16,
 };
 
 typedef struct entity_type_t
@@ -89,15 +93,31 @@ typedef struct net_t
 {
 	heap_t* heap;
 	ecs_t* ecs;
+	object_pool_t* packet_pool;
 
 	int sequence;
 
 	SOCKET sock;
 	thread_t* recv_thread;
 
-	mutex_t* connections_mutex;
+	rwlock_t* connections_lock;
 	connection_t connections[3];
 
+	trace_t* trace;
+
+	// Traffic totals, bumped by the send and receive threads.
+	volatile int64_t packets_sent;
+	volatile int64_t bytes_sent;
+	volatile int64_t packets_received;
+	volatile int64_t bytes_received;
+
+	// Totals at the start of the current one second rate window.
+	uint64_t rate_start_ticks;
+	int64_t rate_packets_sent;
+	int64_t rate_bytes_sent;
+	int64_t rate_packets_received;
+	int64_t rate_bytes_received;
+
 	entity_type_t entity_types[k_max_entity_types];
 	entity_data_t entities[k_max_entities];
 	snapshot_t snapshots[k_max_snapshots];
@@ -105,24 +125,29 @@ typedef struct net_t
 
 static int recv_thread_func(void* user);
 static connection_t* find_or_create_connection(net_t* net, const net_address_t* address);
+static connection_t* find_connection(net_t* net, const net_address_t* address);
 
 static void timeout_old_connections(net_t* net);
 static void snapshot_entities(net_t* net);
 static void packet_send(connection_t* connection);
 static void packet_recv(connection_t* connection);
+static void report_counters(net_t* net);
 
-net_t* net_create(heap_t* heap, ecs_t* ecs)
+net_t* net_create(heap_t* heap, ecs_t* ecs, trace_t* trace)
 {
 	net_t* net = heap_alloc(heap, sizeof(net_t), 8);
 	memset(net, 0, sizeof(net_t));
 	net->heap = heap;
 	net->ecs = ecs;
+	net->trace = trace;
+	net->rate_start_ticks = timer_get_ticks();
+	net->packet_pool = object_pool_create(heap, sizeof(packet_t), 8, k_packet_pool_capacity);
 
 	WSADATA data;
 	WSAStartup(MAKEWORD(2, 2), &data);
 
 	net->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	net->connections_mutex = mutex_create();
+	net->connections_lock = rwlock_create();
 
 	struct sockaddr_in address;
 	address.sin_family = AF_INET;
@@ -134,7 +159,7 @@ net_t* net_create(heap_t* heap, ecs_t* ecs)
 	getsockname(net->sock, (struct sockaddr*)&address, &address_len);
 	debug_print(k_print_info, "Net bound port %d\n", ntohs(address.sin_port));
 
-	net->recv_thread = thread_create(recv_thread_func, net);
+	net->recv_thread = thread_create_ex(recv_thread_func, net, "net recv", 0, k_thread_priority_normal, 0);
 
 	return net;
 }
@@ -145,7 +170,8 @@ void net_destroy(net_t* net)
 	closesocket(net->sock);
 	thread_destroy(net->recv_thread);
 	WSACleanup();
-	mutex_destroy(net->connections_mutex);
+	rwlock_destroy(net->connections_lock);
+	object_pool_destroy(net->packet_pool);
 	heap_free(net->heap, net);
 }
 
@@ -162,6 +188,7 @@ void net_update(net_t* net)
 			packet_recv(c);
 		}
 	}
+	report_counters(net);
 	net->sequence++;
 }
 
@@ -172,7 +199,7 @@ void net_connect(net_t* net, const net_address_t* address)
 
 void net_disconnect_all(net_t* net)
 {
-	mutex_lock(net->connections_mutex);
+	rwlock_lock_write(net->connections_lock);
 
 	for (int i = 0; i < _countof(net->connections); ++i)
 	{
@@ -187,7 +214,7 @@ void net_disconnect_all(net_t* net)
 	}
 	memset(net->connections, 0, sizeof(net->connections));
 
-	mutex_unlock(net->connections_mutex);
+	rwlock_unlock_write(net->connections_lock);
 }
 
 void net_state_register_entity_type(net_t* net, int type, uint64_t component_mask, uint64_t replicated_component_mask, net_configure_entity_callback_t configure_callback, void* configure_callback_data)
@@ -293,12 +320,14 @@ static int send_thread_func(void* user)
 			packet->data, packet->size, 0,
 			(struct sockaddr*)&address, sizeof(address));
 
-		heap_free(connection->net->heap, packet);
+		object_pool_put(connection->net->packet_pool, packet);
 
 		if (bytes <= 0)
 		{
 			break;
 		}
+		atomic_fetch_add64(&connection->net->packets_sent, 1, k_atomic_relaxed);
+		atomic_fetch_add64(&connection->net->bytes_sent, bytes, k_atomic_relaxed);
 	}
 
 	return 0;
@@ -306,19 +335,19 @@ static int send_thread_func(void* user)
 
 static connection_t* find_or_create_connection(net_t* net, const net_address_t* address)
 {
-	connection_t* result = NULL;
-
-	mutex_lock(net->connections_mutex);
-
-	for (int i = 0; i < _countof(net->connections); ++i)
+	// Nearly every datagram is from a known peer, so look it up under a shared lock first.
+	rwlock_lock_read(net->connections_lock);
+	connection_t* result = find_connection(net, address);
+	rwlock_unlock_read(net->connections_lock);
+	if (result)
 	{
-		connection_t* c = &net->connections[i];
-		if (memcmp(&c->address, address, sizeof(net_address_t)) == 0)
-		{
-			result = c;
-			break;
-		}
+		return result;
 	}
+
+	// Look again under the exclusive lock in case another thread added it in between.
+	rwlock_lock_write(net->connections_lock);
+
+	result = find_connection(net, address);
 	if (!result)
 	{
 		for (int i = 0; i < _countof(net->connections); ++i)
@@ -333,7 +362,7 @@ static connection_t* find_or_create_connection(net_t* net, const net_address_t*
 				c->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
 				c->send_queue = queue_create(net->heap, 3);
 				c->recv_queue = queue_create(net->heap, 3);
-				c->send_thread = thread_create(send_thread_func, c);
+				c->send_thread = thread_create_ex(send_thread_func, c, "net send", 0, k_thread_priority_normal, 0);
 
 				result = c;
 				break;
@@ -341,18 +370,31 @@ static connection_t* find_or_create_connection(net_t* net, const net_address_t*
 		}
 	}
 
-	mutex_unlock(net->connections_mutex);
+	rwlock_unlock_write(net->connections_lock);
 
 	return result;
 }
 
+static connection_t* find_connection(net_t* net, const net_address_t* address)
+{
+	for (int i = 0; i < _countof(net->connections); ++i)
+	{
+		connection_t* c = &net->connections[i];
+		if (memcmp(&c->address, address, sizeof(net_address_t)) == 0)
+		{
+			return c;
+		}
+	}
+	return NULL;
+}
+
 static int recv_thread_func(void* user)
 {
 	net_t* net = user;
 
 	while (true)
 	{
-		packet_t* packet = heap_alloc(net->heap, sizeof(packet_t), 8);
+		packet_t* packet = object_pool_get(net->packet_pool);
 
 		struct sockaddr_in address;
 		int address_len = sizeof(address);
@@ -361,11 +403,13 @@ static int recv_thread_func(void* user)
 			(struct sockaddr*)&address, &address_len);
 		if (bytes <= 0)
 		{
-			heap_free(net->heap, packet);
+			object_pool_put(net->packet_pool, packet);
 			break;
 		}
 
 		packet->size = bytes;
+		atomic_fetch_add64(&net->packets_received, 1, k_atomic_relaxed);
+		atomic_fetch_add64(&net->bytes_received, bytes, k_atomic_relaxed);
 
 		net_address_t net_addr;
 		net_addr.port = ntohs(address.sin_port);
@@ -378,12 +422,15 @@ static int recv_thread_func(void* user)
 		if (!connection)
 		{
 			debug_print(k_print_info, "Too many connections!\n");
-			heap_free(net->heap, packet);
+			object_pool_put(net->packet_pool, packet);
 			continue;
 		}
 		connection->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
 
-		queue_try_push(connection->recv_queue, packet);
+		if (!queue_try_push(connection->recv_queue, packet))
+		{
+			object_pool_put(net->packet_pool, packet);
+		}
 	}
 
 	return 0;
@@ -391,9 +438,28 @@ static int recv_thread_func(void* user)
 
 static void timeout_old_connections(net_t* net)
 {
-	mutex_lock(net->connections_mutex);
-
 	uint32_t now = timer_ticks_to_ms(timer_get_ticks());
+
+	// Runs every update and rarely finds anything, so check under a shared lock first.
+	bool any_expired = false;
+	rwlock_lock_read(net->connections_lock);
+	for (int i = 0; i < _countof(net->connections); ++i)
+	{
+		connection_t* c = &net->connections[i];
+		if (c->address.port && c->last_recv_ms + k_timeout_ms < now)
+		{
+			any_expired = true;
+			break;
+		}
+	}
+	rwlock_unlock_read(net->connections_lock);
+	if (!any_expired)
+	{
+		return;
+	}
+
+	rwlock_lock_write(net->connections_lock);
+
 	for (int i = 0; i < _countof(net->connections); ++i)
 	{
 		connection_t* c = &net->connections[i];
@@ -409,7 +475,7 @@ static void timeout_old_connections(net_t* net)
 		}
 	}
 
-	mutex_unlock(net->connections_mutex);
+	rwlock_unlock_write(net->connections_lock);
 }
 
 static void snapshot_entities(net_t* net)
@@ -507,7 +573,7 @@ static void packet_send(connection_t* connection)
 {
 	net_t* net = connection->net;
 
-	packet_t* packet = heap_alloc(net->heap, sizeof(packet_t), 8);
+	packet_t* packet = object_pool_get(net->packet_pool);
 
 	packet_header_t header =
 	{
@@ -601,8 +667,13 @@ static void packet_recv(connection_t* connection)
 	while (true)
 	{
 		packet_t* packet = queue_try_pop(connection->recv_queue);
-		if (!packet || !packet->size)
+		if (!packet)
+		{
+			break;
+		}
+		if (!packet->size)
 		{
+			object_pool_put(net->packet_pool, packet);
 			break;
 		}
 
@@ -610,6 +681,7 @@ static void packet_recv(connection_t* connection)
 		memcpy(&header, packet->data, sizeof(header));
 		if (header.sequence <= connection->incoming_sequence)
 		{
+			object_pool_put(net->packet_pool, packet);
 			continue;
 		}
 
@@ -618,6 +690,48 @@ static void packet_recv(connection_t* connection)
 
 		packet_read_entities(connection, &packet->data[sizeof(header)], packet->size - sizeof(header));
 
-		heap_free(net->heap, packet);
+		object_pool_put(net->packet_pool, packet);
 	}
 }
+
+static void report_counters(net_t* net)
+{
+	int send_depth = 0;
+	int recv_depth = 0;
+	for (int i = 0; i < _countof(net->connections); ++i)
+	{
+		connection_t* c = &net->connections[i];
+		if (c->address.port)
+		{
+			send_depth += queue_get_count(c->send_queue);
+			recv_depth += queue_get_count(c->recv_queue);
+		}
+	}
+	trace_counter_set(net->trace, "net send queue", send_depth);
+	trace_counter_set(net->trace, "net recv queue", recv_depth);
+
+	// Rates are only updated once a second, so the tracks read as per-second steps.
+	uint64_t now = timer_get_ticks();
+	uint64_t elapsed = now - net->rate_start_ticks;
+	if (elapsed < timer_get_ticks_per_second())
+	{
+		return;
+	}
+
+	int64_t packets_sent = atomic_load64(&net->packets_sent, k_atomic_relaxed);
+	int64_t bytes_sent = atomic_load64(&net->bytes_sent, k_atomic_relaxed);
+	int64_t packets_received = atomic_load64(&net->packets_received, k_atomic_relaxed);
+	int64_t bytes_received = atomic_load64(&net->bytes_received, k_atomic_relaxed);
+
+	double scale = (double)timer_get_ticks_per_second() / (double)elapsed;
+	trace_counter_set(net->trace, "net packets sent/s", (int64_t)((packets_sent - net->rate_packets_sent) * scale));
+	trace_counter_set(net->trace, "net bytes sent/s", (int64_t)((bytes_sent - net->rate_bytes_sent) * scale));
+	trace_counter_set(net->trace, "net packets received/s", (int64_t)((packets_received - net->rate_packets_received) * scale));
+	trace_counter_set(net->trace, "net bytes received/s", (int64_t)((bytes_received - net->rate_bytes_received) * scale));
+
+	net->rate_start_ticks = now;
+	net->rate_packets_sent = packets_sent;
+	net->rate_bytes_sent = bytes_sent;
+	net->rate_packets_received = packets_received;
+	net->rate_bytes_received = bytes_received;
+}
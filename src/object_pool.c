@@ -0,0 +1,154 @@
+#include "object_pool.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "heap.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// The free list head packs a pointer and a tag into 64 bits.
+// User mode addresses fit in 48 bits, the tag guards against ABA in the top 16.
+#define OBJECT_POOL_POINTER_BITS 48
+#define OBJECT_POOL_POINTER_MASK ((1ULL << OBJECT_POOL_POINTER_BITS) - 1)
+
+typedef struct object_pool_element_t
+{
+	struct object_pool_element_t* next;
+} object_pool_element_t;
+
+typedef struct object_pool_chunk_t
+{
+	struct object_pool_chunk_t* next;
+} object_pool_chunk_t;
+
+typedef struct object_pool_t
+{
+	heap_t* heap;
+	size_t element_size;
+	size_t alignment;
+	size_t header_size;
+	int capacity;
+	object_pool_chunk_t* volatile chunks;
+	volatile int64_t free_head;
+} object_pool_t;
+
+static object_pool_element_t* free_head_pointer(int64_t head);
+static int64_t free_head_make(int64_t old_head, object_pool_element_t* element);
+static void free_list_push(object_pool_t* pool, object_pool_element_t* first, object_pool_element_t* last);
+static bool object_pool_grow(object_pool_t* pool);
+
+object_pool_t* object_pool_create(heap_t* heap, size_t element_size, size_t alignment, int capacity)
+{
+	object_pool_t* pool = heap_alloc(heap, sizeof(object_pool_t), 8);
+	pool->heap = heap;
+	pool->alignment = __max(alignment, _Alignof(object_pool_element_t));
+	pool->element_size = (__max(element_size, sizeof(object_pool_element_t)) + pool->alignment - 1) & ~(pool->alignment - 1);
+	pool->header_size = (sizeof(object_pool_chunk_t) + pool->alignment - 1) & ~(pool->alignment - 1);
+	pool->capacity = __max(capacity, 1);
+	pool->chunks = NULL;
+	pool->free_head = 0;
+	return pool;
+}
+
+void object_pool_destroy(object_pool_t* pool)
+{
+	object_pool_chunk_t* chunk = pool->chunks;
+	while (chunk)
+	{
+		object_pool_chunk_t* next = chunk->next;
+		heap_free(pool->heap, chunk);
+		chunk = next;
+	}
+	heap_free(pool->heap, pool);
+}
+
+void* object_pool_get(object_pool_t* pool)
+{
+	while (true)
+	{
+		int64_t old_head = atomic_load64(&pool->free_head, k_atomic_acquire);
+		object_pool_element_t* element = free_head_pointer(old_head);
+		if (!element)
+		{
+			if (!object_pool_grow(pool))
+			{
+				debug_print(
+					k_print_error,
+					"Pool out of memory!\n");
+				return NULL;
+			}
+			continue;
+		}
+
+		// Element may be taken by another thread before our CAS; chunk memory stays valid
+		// and the tag makes our CAS fail, so reading a stale next pointer is harmless.
+		int64_t new_head = free_head_make(old_head, element->next);
+		if (atomic_compare_exchange64(&pool->free_head, old_head, new_head, k_atomic_acquire) == old_head)
+		{
+			return element;
+		}
+	}
+}
+
+void object_pool_put(object_pool_t* pool, void* element)
+{
+	free_list_push(pool, element, element);
+}
+
+static object_pool_element_t* free_head_pointer(int64_t head)
+{
+	return (object_pool_element_t*)(uintptr_t)((uint64_t)head & OBJECT_POOL_POINTER_MASK);
+}
+
+static int64_t free_head_make(int64_t old_head, object_pool_element_t* element)
+{
+	uint64_t tag = ((uint64_t)old_head >> OBJECT_POOL_POINTER_BITS) + 1;
+	return (int64_t)((tag << OBJECT_POOL_POINTER_BITS) | ((uint64_t)(uintptr_t)element & OBJECT_POOL_POINTER_MASK));
+}
+
+static void free_list_push(object_pool_t* pool, object_pool_element_t* first, object_pool_element_t* last)
+{
+	while (true)
+	{
+		int64_t old_head = atomic_load64(&pool->free_head, k_atomic_relaxed);
+		last->next = free_head_pointer(old_head);
+		int64_t new_head = free_head_make(old_head, first);
+		if (atomic_compare_exchange64(&pool->free_head, old_head, new_head, k_atomic_release) == old_head)
+		{
+			break;
+		}
+	}
+}
+
+static bool object_pool_grow(object_pool_t* pool)
+{
+	object_pool_chunk_t* chunk = heap_alloc(pool->heap, pool->header_size + pool->element_size * pool->capacity, pool->alignment);
+	if (!chunk)
+	{
+		return false;
+	}
+
+	// Link the elements up privately, then publish the whole chain with one CAS.
+	char* elements = (char*)chunk + pool->header_size;
+	for (int i = 0; i < pool->capacity - 1; ++i)
+	{
+		((object_pool_element_t*)&elements[pool->element_size * i])->next = (object_pool_element_t*)&elements[pool->element_size * (i + 1)];
+	}
+	object_pool_element_t* first = (object_pool_element_t*)elements;
+	object_pool_element_t* last = (object_pool_element_t*)&elements[pool->element_size * (pool->capacity - 1)];
+
+	while (true)
+	{
+		object_pool_chunk_t* old_chunks = atomic_load_ptr((void* volatile*)&pool->chunks, k_atomic_relaxed);
+		chunk->next = old_chunks;
+		if (atomic_compare_exchange_ptr((void* volatile*)&pool->chunks, old_chunks, chunk, k_atomic_release) == old_chunks)
+		{
+			break;
+		}
+	}
+
+	free_list_push(pool, first, last);
+	return true;
+}
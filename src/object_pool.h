@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+// Fixed-size Object Pool
+//
+// Main object, object_pool_t, hands out fixed-size elements carved from chunks of heap memory.
+// Getting and putting elements is lock-free and safe from multiple threads.
+// The pool grows by a chunk when it runs out of elements. Chunks are freed on destroy.
+
+// Handle to an object pool.
+typedef struct object_pool_t object_pool_t;
+
+typedef struct heap_t heap_t;
+
+// Creates a new object pool.
+// Elements are at least element_size bytes and aligned to alignment.
+// Capacity is the number of elements allocated per chunk.
+object_pool_t* object_pool_create(heap_t* heap, size_t element_size, size_t alignment, int capacity);
+
+// Destroy a previously created pool.
+// All elements are returned to the heap, including those not put back.
+void object_pool_destroy(object_pool_t* pool);
+
+// Get an element from a pool.
+// If the pool is empty, grows it by another chunk.
+// Returns NULL if out of memory.
+void* object_pool_get(object_pool_t* pool);
+
+// Return an element to the pool it was taken from.
+void object_pool_put(object_pool_t* pool, void* element);
@@ -1,76 +1,288 @@
+#include "queue.h"
+
 #include "atomic.h"
 #include "heap.h"
-#include "semaphore.h"
 
+#include <stdint.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	k_queue_cache_line = 64,
+
+	// Attempts to push or pop before a blocking call parks the thread.
+	k_queue_spin_count = 64,
+};
+
+// A slot in the ring.
+// The sequence number says whose turn it is to use the slot:
+// equal to a push position when empty, push position + 1 when full.
+typedef struct queue_cell_t
+{
+	volatile int64_t sequence;
+	void* item;
+} queue_cell_t;
+
+// Bounded lock-free MPMC ring buffer, after Dmitry Vyukov's design.
+// Producer and consumer positions are 64-bit and only ever increase,
+// and live on separate cache lines so pushes and pops do not contend.
 typedef struct queue_t
 {
 	heap_t* heap;
-	semaphore_t* used_items;
-	semaphore_t* free_items;
-	void** items;
-	int capacity;
-	int head_index;
-	int tail_index;
+	queue_cell_t* cells;
+	int64_t mask;
+
+	// Threads blocked in queue_pop wait on pop_signal, which is bumped by
+	// pushes only when pop_waiters is non-zero. Likewise for queue_push.
+	volatile int pop_waiters;
+	volatile int pop_signal;
+	volatile int push_waiters;
+	volatile int push_signal;
+
+	char pad0[k_queue_cache_line];
+	volatile int64_t push_position;
+	char pad1[k_queue_cache_line - sizeof(int64_t)];
+	volatile int64_t pop_position;
+	char pad2[k_queue_cache_line - sizeof(int64_t)];
 } queue_t;
 
+static int queue_push_range(queue_t* queue, void** items, int count);
+static int queue_pop_range(queue_t* queue, void** items, int capacity);
+static void queue_wake(volatile int* waiters, volatile int* signal, int count);
+
 queue_t* queue_create(heap_t* heap, int capacity)
 {
-	queue_t* queue = heap_alloc(heap, sizeof(queue_t), 8);
-	queue->items = heap_alloc(heap, sizeof(void*) * capacity, 8);
-	queue->used_items = semaphore_create(0, capacity);
-	queue->free_items = semaphore_create(capacity, capacity);
+	int64_t size = 1;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+
+	queue_t* queue = heap_alloc(heap, sizeof(queue_t), k_queue_cache_line);
+	queue->cells = heap_alloc(heap, sizeof(queue_cell_t) * size, k_queue_cache_line);
+	for (int64_t i = 0; i < size; ++i)
+	{
+		queue->cells[i].sequence = i;
+		queue->cells[i].item = NULL;
+	}
 	queue->heap = heap;
-	queue->capacity = capacity;
-	queue->head_index = 0;
-	queue->tail_index = 0;
+	queue->mask = size - 1;
+	queue->pop_waiters = 0;
+	queue->pop_signal = 0;
+	queue->push_waiters = 0;
+	queue->push_signal = 0;
+	queue->push_position = 0;
+	queue->pop_position = 0;
 	return queue;
 }
 
 void queue_destroy(queue_t* queue)
 {
-	semaphore_destroy(queue->used_items);
-	semaphore_destroy(queue->free_items);
-	heap_free(queue->heap, queue->items);
+	heap_free(queue->heap, queue->cells);
 	heap_free(queue->heap, queue);
 }
 
 void queue_push(queue_t* queue, void* item)
 {
-	semaphore_acquire(queue->free_items);
-	int index = atomic_increment(&queue->tail_index) % queue->capacity;
-	queue->items[index] = item;
-	semaphore_release(queue->used_items);
+	queue_push_batch(queue, &item, 1);
 }
 
 void* queue_pop(queue_t* queue)
 {
-	semaphore_acquire(queue->used_items);
-	int index = atomic_increment(&queue->head_index) % queue->capacity;
-	void* item = queue->items[index];
-	semaphore_release(queue->free_items);
+	void* item;
+	queue_pop_batch(queue, &item, 1, true);
 	return item;
 }
 
 bool queue_try_push(queue_t* queue, void* item)
 {
-	if (semaphore_try_acquire(queue->free_items))
+	return queue_push_range(queue, &item, 1) == 1;
+}
+
+void* queue_try_pop(queue_t* queue)
+{
+	void* item;
+	return queue_pop_range(queue, &item, 1) ? item : NULL;
+}
+
+int queue_get_count(queue_t* queue)
+{
+	int64_t pop_position = atomic_load64(&queue->pop_position, k_atomic_relaxed);
+	int64_t push_position = atomic_load64(&queue->push_position, k_atomic_relaxed);
+	return push_position > pop_position ? (int)(push_position - pop_position) : 0;
+}
+
+void queue_push_batch(queue_t* queue, void** items, int count)
+{
+	int pushed = queue_push_range(queue, items, count);
+	for (int i = 0; pushed < count && i < k_queue_spin_count; ++i)
 	{
-		int index = atomic_increment(&queue->tail_index) % queue->capacity;
-		queue->items[index] = item;
-		semaphore_release(queue->used_items);
-		return true;
+		YieldProcessor();
+		pushed += queue_push_range(queue, items + pushed, count - pushed);
+	}
+
+	// Register as a waiter before the final check so a pop that frees a slot
+	// after it is guaranteed to see us and bump the signal.
+	while (pushed < count)
+	{
+		atomic_fetch_add32(&queue->push_waiters, 1, k_atomic_seq_cst);
+		int signal = atomic_load32(&queue->push_signal, k_atomic_relaxed);
+		pushed += queue_push_range(queue, items + pushed, count - pushed);
+		if (pushed < count)
+		{
+			WaitOnAddress(&queue->push_signal, &signal, sizeof(signal), INFINITE);
+		}
+		atomic_fetch_add32(&queue->push_waiters, -1, k_atomic_relaxed);
 	}
-	return false;
 }
 
-void* queue_try_pop(queue_t* queue)
+int queue_pop_batch(queue_t* queue, void** items, int capacity, bool wait)
+{
+	int popped = queue_pop_range(queue, items, capacity);
+	if (popped || !wait)
+	{
+		return popped;
+	}
+
+	for (int i = 0; !popped && i < k_queue_spin_count; ++i)
+	{
+		YieldProcessor();
+		popped = queue_pop_range(queue, items, capacity);
+	}
+
+	while (!popped)
+	{
+		atomic_fetch_add32(&queue->pop_waiters, 1, k_atomic_seq_cst);
+		int signal = atomic_load32(&queue->pop_signal, k_atomic_relaxed);
+		popped = queue_pop_range(queue, items, capacity);
+		if (!popped)
+		{
+			WaitOnAddress(&queue->pop_signal, &signal, sizeof(signal), INFINITE);
+		}
+		atomic_fetch_add32(&queue->pop_waiters, -1, k_atomic_relaxed);
+	}
+	return popped;
+}
+
+static int queue_push_range(queue_t* queue, void** items, int count)
+{
+	if (count <= 0)
+	{
+		return 0;
+	}
+
+	// Claim the run of empty slots at the push position with a single CAS.
+	int64_t position = atomic_load64(&queue->push_position, k_atomic_relaxed);
+	int reserved;
+	while (true)
+	{
+		int64_t difference = 0;
+		for (reserved = 0; reserved < count; ++reserved)
+		{
+			queue_cell_t* cell = &queue->cells[(position + reserved) & queue->mask];
+			difference = atomic_load64(&cell->sequence, k_atomic_acquire) - (position + reserved);
+			if (difference != 0)
+			{
+				break;
+			}
+		}
+
+		if (reserved == 0)
+		{
+			if (difference < 0)
+			{
+				// The slot still holds the item from one lap ago: full.
+				return 0;
+			}
+			position = atomic_load64(&queue->push_position, k_atomic_relaxed);
+			continue;
+		}
+
+		int64_t previous = atomic_compare_exchange64(&queue->push_position, position, position + reserved, k_atomic_relaxed);
+		if (previous == position)
+		{
+			break;
+		}
+		position = previous;
+	}
+
+	for (int i = 0; i < reserved; ++i)
+	{
+		queue_cell_t* cell = &queue->cells[(position + i) & queue->mask];
+		cell->item = items[i];
+
+		// Publishing seq_cst orders it before the waiter check.
+		atomic_store64(&cell->sequence, position + i + 1, k_atomic_seq_cst);
+	}
+	queue_wake(&queue->pop_waiters, &queue->pop_signal, reserved);
+	return reserved;
+}
+
+static int queue_pop_range(queue_t* queue, void** items, int capacity)
+{
+	if (capacity <= 0)
+	{
+		return 0;
+	}
+
+	int64_t position = atomic_load64(&queue->pop_position, k_atomic_relaxed);
+	int reserved;
+	while (true)
+	{
+		int64_t difference = 0;
+		for (reserved = 0; reserved < capacity; ++reserved)
+		{
+			queue_cell_t* cell = &queue->cells[(position + reserved) & queue->mask];
+			difference = atomic_load64(&cell->sequence, k_atomic_acquire) - (position + reserved + 1);
+			if (difference != 0)
+			{
+				break;
+			}
+		}
+
+		if (reserved == 0)
+		{
+			if (difference < 0)
+			{
+				// The slot has not been pushed to yet: empty.
+				return 0;
+			}
+			position = atomic_load64(&queue->pop_position, k_atomic_relaxed);
+			continue;
+		}
+
+		int64_t previous = atomic_compare_exchange64(&queue->pop_position, position, position + reserved, k_atomic_relaxed);
+		if (previous == position)
+		{
+			break;
+		}
+		position = previous;
+	}
+
+	for (int i = 0; i < reserved; ++i)
+	{
+		queue_cell_t* cell = &queue->cells[(position + i) & queue->mask];
+		items[i] = cell->item;
+		atomic_store64(&cell->sequence, position + i + queue->mask + 1, k_atomic_seq_cst);
+	}
+	queue_wake(&queue->push_waiters, &queue->push_signal, reserved);
+	return reserved;
+}
+
+static void queue_wake(volatile int* waiters, volatile int* signal, int count)
 {
-	if (semaphore_try_acquire(queue->used_items))
+	if (atomic_load32(waiters, k_atomic_relaxed))
 	{
-		int index = atomic_increment(&queue->head_index) % queue->capacity;
-		void* item = queue->items[index];
-		semaphore_release(queue->free_items);
-		return item;
+		atomic_fetch_add32(signal, 1, k_atomic_seq_cst);
+		if (count > 1)
+		{
+			WakeByAddressAll((PVOID)signal);
+		}
+		else
+		{
+			WakeByAddressSingle((PVOID)signal);
+		}
 	}
-	return NULL;
 }
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 
 // Thread-safe Queue container
+// Lock-free bounded ring; threads only block when the queue is full or empty.
 
 // Handle to a thread-safe queue.
 typedef struct queue_t queue_t;
@@ -10,6 +11,7 @@ typedef struct queue_t queue_t;
 typedef struct heap_t heap_t;
 
 // Create a queue with the defined capacity.
+// Capacity is rounded up to a power of two.
 queue_t* queue_create(heap_t* heap, int capacity);
 
 // Destroy a previously created queue.
@@ -31,6 +33,22 @@ void* queue_pop(queue_t* queue);
 bool queue_try_push(queue_t* queue, void* item);
 
 // Pop an item off a queue (FIFO order).
-// If the queue is empty, returns NULL.
+// If the queue is empty, returns NULL; use queue_pop if NULL items are pushed.
 // Safe for multiple threads to pop at the same time.
 void* queue_try_pop(queue_t* queue);
+
+// Get the number of items in the queue.
+// Only a snapshot when other threads are pushing or popping.
+int queue_get_count(queue_t* queue);
+
+// Push count items onto a queue, in order.
+// Runs of free slots are reserved with a single atomic operation.
+// If the queue fills, blocks until space is available for the rest.
+// Items from concurrent pushers may interleave between runs.
+void queue_push_batch(queue_t* queue, void** items, int count);
+
+// Pop up to capacity items off a queue (FIFO order) into items.
+// Runs of available items are reserved with a single atomic operation.
+// If the queue is empty and wait is true, blocks until at least one item is available.
+// Returns the number of items popped.
+int queue_pop_batch(queue_t* queue, void** items, int capacity, bool wait);
@@ -3,8 +3,10 @@
 #include "ecs.h"
 #include "gpu.h"
 #include "heap.h"
-#include "queue.h"
+#include "semaphore.h"
+#include "spsc_ring.h"
 #include "thread.h"
+#include "trace.h"
 #include "wm.h"
 
 #include <assert.h>
@@ -13,12 +15,19 @@
 enum
 {
 	k_render_max_drawables = 512,
+
+	// Commands and their uniform data are written inline into the ring.
+	k_render_ring_size = 512 * 1024,
+
+	// Frames the game thread may queue ahead of the render thread.
+	k_render_max_frames_ahead = 2,
 };
 
 typedef enum command_type_t
 {
 	k_command_frame_done,
 	k_command_model,
+	k_command_exit,
 } command_type_t;
 
 typedef struct model_command_t
@@ -30,11 +39,6 @@ typedef struct model_command_t
 	gpu_uniform_buffer_info_t uniform_buffer;
 } model_command_t;
 
-typedef struct frame_done_command_t
-{
-	command_type_t type;
-} frame_done_command_t;
-
 typedef struct draw_instance_t
 {
 	ecs_entity_ref_t entity;
@@ -64,7 +68,9 @@ typedef struct render_t
 	wm_window_t* window;
 	thread_t* thread;
 	gpu_t* gpu;
-	queue_t* queue;
+	spsc_ring_t* ring;
+	semaphore_t* free_frames;
+	trace_t* trace;
 
 	int frame_counter;
 	int gpu_frame_count;
@@ -82,47 +88,61 @@ static draw_shader_t* create_or_get_shader_for_model_command(render_t* render, m
 static draw_mesh_t* create_or_get_mesh_for_model_command(render_t* render, model_command_t* command);
 static draw_instance_t* create_or_get_instance_for_model_command(render_t* render, model_command_t* command, gpu_shader_t* shader);
 static void destroy_stale_data(render_t* render);
+static void push_command(render_t* render, command_type_t type);
 
-render_t* render_create(heap_t* heap, wm_window_t* window)
+render_t* render_create(heap_t* heap, wm_window_t* window, trace_t* trace)
 {
 	render_t* render = heap_alloc(heap, sizeof(render_t), 8);
 	render->heap = heap;
 	render->window = window;
-	render->queue = queue_create(heap, 3);
+	render->trace = trace;
+	render->ring = spsc_ring_create(heap, k_render_ring_size);
+	render->free_frames = semaphore_create_named(k_render_max_frames_ahead, k_render_max_frames_ahead, "render frames");
 	render->frame_counter = 0;
 	render->instance_count = 0;
 	render->mesh_count = 0;
 	render->shader_count = 0;
-	render->thread = thread_create(render_thread_func, render);
+	// The game thread runs on the first core; see main.
+	render->thread = thread_create_ex(render_thread_func, render, "render",
+		thread_get_core_affinity(1), k_thread_priority_high, 0);
 	return render;
 }
 
 void render_destroy(render_t* render)
 {
-	queue_push(render->queue, NULL);
+	push_command(render, k_command_exit);
 	thread_destroy(render->thread);
-	queue_destroy(render->queue);
+	spsc_ring_destroy(render->ring);
+	semaphore_destroy(render->free_frames);
 	heap_free(render->heap, render);
 }
 
 void render_push_model(render_t* render, ecs_entity_ref_t* entity, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform)
 {
-	model_command_t* command = heap_alloc(render->heap, sizeof(model_command_t), 8);
+	// Command and uniform data are written straight into the ring; the render thread
+	// releases them once the uniform data has been copied to the GPU.
+	model_command_t* command = spsc_ring_write_begin(render->ring, sizeof(model_command_t) + uniform->size);
+	if (!command)
+	{
+		return;
+	}
 	command->type = k_command_model;
 	command->entity = *entity;
 	command->mesh = mesh;
 	command->shader = shader;
 	command->uniform_buffer.size = uniform->size;
-	command->uniform_buffer.data = heap_alloc(render->heap, uniform->size, 8);
+	command->uniform_buffer.data = command + 1;
 	memcpy(command->uniform_buffer.data, uniform->data, uniform->size);
-	queue_push(render->queue, command);
+	spsc_ring_write_end(render->ring);
 }
 
 void render_push_done(render_t* render)
 {
-	frame_done_command_t* command = heap_alloc(render->heap, sizeof(frame_done_command_t), 8);
-	command->type = k_command_frame_done;
-	queue_push(render->queue, command);
+	// A ring that stays full means the render thread is the bottleneck.
+	trace_counter_set(render->trace, "render queue bytes", (int64_t)spsc_ring_get_size(render->ring));
+
+	push_command(render, k_command_frame_done);
+	semaphore_acquire(render->free_frames);
 }
 
 static int render_thread_func(void* user)
@@ -136,12 +156,15 @@ static int render_thread_func(void* user)
 	gpu_pipeline_t* last_pipeline = NULL;
 	gpu_mesh_t* last_mesh = NULL;
 	int frame_index = 0;
+	int draw_count = 0;
 
 	while (true)
 	{
-		command_type_t* type = queue_pop(render->queue);
-		if (!type)
+		size_t size;
+		command_type_t* type = spsc_ring_read_begin(render->ring, &size);
+		if (*type == k_command_exit)
 		{
+			spsc_ring_read_end(render->ring);
 			break;
 		}
 
@@ -153,6 +176,8 @@ static int render_thread_func(void* user)
 		if (*type == k_command_frame_done)
 		{
 			gpu_frame_end(render->gpu);
+			trace_counter_set(render->trace, "render draws", draw_count);
+			draw_count = 0;
 			cmdbuf = NULL;
 			last_pipeline = NULL;
 			last_mesh = NULL;
@@ -160,6 +185,8 @@ static int render_thread_func(void* user)
 			destroy_stale_data(render);
 			++render->frame_counter;
 			frame_index = render->frame_counter % render->gpu_frame_count;
+
+			semaphore_release(render->free_frames);
 		}
 		else if (*type == k_command_model)
 		{
@@ -168,8 +195,6 @@ static int render_thread_func(void* user)
 			draw_mesh_t* mesh = create_or_get_mesh_for_model_command(render, command);
 			draw_instance_t* instance = create_or_get_instance_for_model_command(render, command, shader->shader);
 
-			heap_free(render->heap, command->uniform_buffer.data);
-
 			if (last_pipeline != shader->pipeline)
 			{
 				gpu_cmd_pipeline_bind(render->gpu, cmdbuf, shader->pipeline);
@@ -182,9 +207,9 @@ static int render_thread_func(void* user)
 			}
 			gpu_cmd_descriptor_bind(render->gpu, cmdbuf, instance->descriptors[frame_index]);
 			gpu_cmd_draw(render->gpu, cmdbuf);
+			++draw_count;
 		}
-
-		heap_free(render->heap, type);
+		spsc_ring_read_end(render->ring);
 	}
 
 	gpu_wait_until_idle(render->gpu);
@@ -334,3 +359,10 @@ static void destroy_stale_data(render_t* render)
 		}
 	}
 }
+
+static void push_command(render_t* render, command_type_t type)
+{
+	command_type_t* command = spsc_ring_write_begin(render->ring, sizeof(command_type_t));
+	*command = type;
+	spsc_ring_write_end(render->ring);
+}
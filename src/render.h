@@ -9,10 +9,12 @@ typedef struct gpu_mesh_info_t gpu_mesh_info_t;
 typedef struct gpu_shader_info_t gpu_shader_info_t;
 typedef struct gpu_uniform_buffer_info_t gpu_uniform_buffer_info_t;
 typedef struct heap_t heap_t;
+typedef struct trace_t trace_t;
 typedef struct wm_window_t wm_window_t;
 
 // Create a render system.
-render_t* render_create(heap_t* heap, wm_window_t* window);
+// Queue size and draw count are reported to trace as counters.
+render_t* render_create(heap_t* heap, wm_window_t* window, trace_t* trace);
 
 // Destroy a render system.
 void render_destroy(render_t* render);
@@ -0,0 +1,137 @@
+#include "rwlock.h"
+
+#include "atomic.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	// State bits. The low bits count readers holding the lock.
+	k_rwlock_reader_mask = (1 << 28) - 1,
+	k_rwlock_waiting = 1 << 28,
+	k_rwlock_writer = 1 << 29,
+
+	// Attempts to take a held lock before parking the thread.
+	k_rwlock_spin_count = 256,
+};
+
+// All lock state is in a single word that threads park on with WaitOnAddress.
+// The waiting bit is set by a thread about to park and tells whoever
+// next frees the lock to wake everyone parked.
+typedef struct rwlock_t
+{
+	volatile int state;
+
+	// Writers that want the lock. Readers hold off while this is non-zero.
+	volatile int writers_waiting;
+} rwlock_t;
+
+static void rwlock_wait(rwlock_t* lock, int state);
+
+rwlock_t* rwlock_create()
+{
+	return HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(rwlock_t));
+}
+
+void rwlock_destroy(rwlock_t* lock)
+{
+	HeapFree(GetProcessHeap(), 0, lock);
+}
+
+void rwlock_lock_read(rwlock_t* lock)
+{
+	int spin_count = 0;
+	while (true)
+	{
+		int state = atomic_load32(&lock->state, k_atomic_relaxed);
+		if (!(state & k_rwlock_writer) && !atomic_load32(&lock->writers_waiting, k_atomic_relaxed))
+		{
+			if (atomic_compare_exchange32(&lock->state, state, state + 1, k_atomic_acquire) == state)
+			{
+				return;
+			}
+			continue;
+		}
+
+		if (++spin_count < k_rwlock_spin_count)
+		{
+			YieldProcessor();
+			continue;
+		}
+		rwlock_wait(lock, state);
+	}
+}
+
+void rwlock_unlock_read(rwlock_t* lock)
+{
+	int state = atomic_fetch_add32(&lock->state, -1, k_atomic_release) - 1;
+
+	// Last reader out wakes anyone parked. If the clear fails, someone else
+	// has taken the lock since and will do the wake when they release it.
+	if (state == k_rwlock_waiting &&
+		atomic_compare_exchange32(&lock->state, k_rwlock_waiting, 0, k_atomic_relaxed) == k_rwlock_waiting)
+	{
+		WakeByAddressAll((PVOID)&lock->state);
+	}
+}
+
+void rwlock_lock_write(rwlock_t* lock)
+{
+	if (rwlock_try_lock_write(lock))
+	{
+		return;
+	}
+
+	atomic_fetch_add32(&lock->writers_waiting, 1, k_atomic_relaxed);
+	int spin_count = 0;
+	while (true)
+	{
+		int state = atomic_load32(&lock->state, k_atomic_relaxed);
+		if (!(state & ~k_rwlock_waiting))
+		{
+			if (atomic_compare_exchange32(&lock->state, state, state | k_rwlock_writer, k_atomic_acquire) == state)
+			{
+				break;
+			}
+			continue;
+		}
+
+		if (++spin_count < k_rwlock_spin_count)
+		{
+			YieldProcessor();
+			continue;
+		}
+		rwlock_wait(lock, state);
+	}
+	atomic_fetch_add32(&lock->writers_waiting, -1, k_atomic_relaxed);
+}
+
+bool rwlock_try_lock_write(rwlock_t* lock)
+{
+	return atomic_compare_exchange32(&lock->state, 0, k_rwlock_writer, k_atomic_acquire) == 0;
+}
+
+void rwlock_unlock_write(rwlock_t* lock)
+{
+	if (atomic_exchange32(&lock->state, 0, k_atomic_release) & k_rwlock_waiting)
+	{
+		WakeByAddressAll((PVOID)&lock->state);
+	}
+}
+
+static void rwlock_wait(rwlock_t* lock, int state)
+{
+	// Publish the waiting bit before parking; if the state moves on
+	// in the meantime, WaitOnAddress returns straight away.
+	if (!(state & k_rwlock_waiting))
+	{
+		int waiting = state | k_rwlock_waiting;
+		if (atomic_compare_exchange32(&lock->state, state, waiting, k_atomic_relaxed) != state)
+		{
+			return;
+		}
+		state = waiting;
+	}
+	WaitOnAddress(&lock->state, &state, sizeof(state), INFINITE);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Reader-writer lock thread synchronization
+//
+// Any number of readers may hold the lock at once, or a single writer.
+// Writers take preference: once a writer is waiting, new readers wait
+// behind it, so a steady stream of readers cannot starve writers.
+// Not recursive in either mode.
+
+// Handle to a reader-writer lock.
+typedef struct rwlock_t rwlock_t;
+
+// Creates a new reader-writer lock.
+rwlock_t* rwlock_create();
+
+// Destroys a previously created reader-writer lock.
+void rwlock_destroy(rwlock_t* lock);
+
+// Locks for shared reading.
+// Blocks while a writer holds the lock or is waiting for it.
+void rwlock_lock_read(rwlock_t* lock);
+
+// Unlocks a lock held for reading.
+void rwlock_unlock_read(rwlock_t* lock);
+
+// Locks for exclusive writing.
+// Blocks while any reader or another writer holds the lock.
+void rwlock_lock_write(rwlock_t* lock);
+
+// Attempts to lock for exclusive writing without waiting.
+// Returns true if the lock was taken.
+bool rwlock_try_lock_write(rwlock_t* lock);
+
+// Unlocks a lock held for writing.
+void rwlock_unlock_write(rwlock_t* lock);
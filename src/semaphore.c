@@ -1,31 +1,65 @@
 #include "semaphore.h"
 
+#include "lock_profile.h"
+#include "timer.h"
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+typedef struct semaphore_t
+{
+	HANDLE handle;
+	lock_profile_site_t* profile_site;
+} semaphore_t;
+
 semaphore_t* semaphore_create(int initial_count, int max_count)
 {
-	HANDLE semaphore = CreateSemaphore(NULL, initial_count, max_count, NULL);
-	return (semaphore_t*)semaphore;
+	return semaphore_create_named(initial_count, max_count, "semaphore");
+}
+
+semaphore_t* semaphore_create_named(int initial_count, int max_count, const char* name)
+{
+	// Semaphores guard heap internals, so like mutexes they come from the process heap.
+	semaphore_t* semaphore = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(semaphore_t));
+	semaphore->handle = CreateSemaphore(NULL, initial_count, max_count, NULL);
+	semaphore->profile_site = lock_profile_site_get(name);
+	return semaphore;
 }
 
 void semaphore_destroy(semaphore_t* semaphore)
 {
-	CloseHandle(semaphore);
+	CloseHandle(semaphore->handle);
+	HeapFree(GetProcessHeap(), 0, semaphore);
 }
 
 void semaphore_acquire(semaphore_t* semaphore)
 {
-	WaitForSingleObject(semaphore, INFINITE);
+	if (!lock_profile_is_enabled())
+	{
+		WaitForSingleObject(semaphore->handle, INFINITE);
+		return;
+	}
+
+	if (WaitForSingleObject(semaphore->handle, 0) == WAIT_OBJECT_0)
+	{
+		lock_profile_record_acquire(semaphore->profile_site, 0, false);
+		return;
+	}
+
+	uint64_t start = timer_get_ticks();
+	lock_profile_wait_begin(semaphore->profile_site);
+	WaitForSingleObject(semaphore->handle, INFINITE);
+	lock_profile_wait_end(semaphore->profile_site);
+	lock_profile_record_acquire(semaphore->profile_site, timer_get_ticks() - start, true);
 }
 
 bool semaphore_try_acquire(semaphore_t* semaphore)
 {
-	DWORD result = WaitForSingleObject(semaphore, 0);
+	DWORD result = WaitForSingleObject(semaphore->handle, 0);
 	return result == WAIT_OBJECT_0;
 }
 
 void semaphore_release(semaphore_t* semaphore)
 {
-	ReleaseSemaphore(semaphore, 1, NULL);
+	ReleaseSemaphore(semaphore->handle, 1, NULL);
 }
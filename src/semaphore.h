@@ -10,6 +10,10 @@ typedef struct semaphore_t semaphore_t;
 // Creates a new semaphore.
 semaphore_t* semaphore_create(int initial_count, int max_count);
 
+// Creates a new semaphore with a name for the lock profiler.
+// Semaphores sharing a name are profiled together. See lock_profile.h.
+semaphore_t* semaphore_create_named(int initial_count, int max_count, const char* name);
+
 // Destroys a previously created semaphore.
 void semaphore_destroy(semaphore_t* semaphore);
 
@@ -8,6 +8,7 @@
 #include "net.h"
 #include "render.h"
 #include "timer_object.h"
+#include "trace.h"
 #include "transform.h"
 #include "wm.h"
 
@@ -49,6 +50,7 @@ typedef struct simple_game_t
 	wm_window_t* window;
 	render_t* render;
 	net_t* net;
+	trace_t* trace;
 
 	timer_object_t* timer;
 
@@ -74,13 +76,14 @@ static void spawn_camera(simple_game_t* game);
 static void update_players(simple_game_t* game);
 static void draw_models(simple_game_t* game);
 
-simple_game_t* simple_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render, int argc, const char** argv)
+simple_game_t* simple_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render, trace_t* trace, int argc, const char** argv)
 {
 	simple_game_t* game = heap_alloc(heap, sizeof(simple_game_t), 8);
 	game->heap = heap;
 	game->fs = fs;
 	game->window = window;
 	game->render = render;
+	game->trace = trace;
 
 	game->timer = timer_object_create(heap, NULL);
 	
@@ -91,7 +94,7 @@ simple_game_t* simple_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, r
 	game->player_type = ecs_register_component_type(game->ecs, "player", sizeof(player_component_t), _Alignof(player_component_t));
 	game->name_type = ecs_register_component_type(game->ecs, "name", sizeof(name_component_t), _Alignof(name_component_t));
 
-	game->net = net_create(heap, game->ecs);
+	game->net = net_create(heap, game->ecs, game->trace);
 	if (argc >= 2)
 	{
 		net_address_t server;
@@ -129,6 +132,10 @@ void simple_game_update(simple_game_t* game)
 	update_players(game);
 	draw_models(game);
 	render_push_done(game->render);
+
+	trace_counter_set(game->trace, "entities", ecs_get_entity_count(game->ecs));
+	trace_counter_set(game->trace, "heap live bytes", (int64_t)heap_get_live_bytes(game->heap));
+	trace_counter_set(game->trace, "fs queue", fs_get_queue_depth(game->fs));
 }
 
 static void load_resources(simple_game_t* game)
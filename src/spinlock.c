@@ -0,0 +1,86 @@
+#include "spinlock.h"
+
+#include "atomic.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	// Lock states.
+	k_spinlock_unlocked = 0,
+	k_spinlock_locked = 1,
+	k_spinlock_contended = 2,
+
+	// Pause hints in the longest backoff step.
+	k_spinlock_max_backoff = 1024,
+
+	// Backoff steps before parking the thread.
+	k_spinlock_spin_rounds = 12,
+};
+
+typedef struct spinlock_t
+{
+	volatile int state;
+} spinlock_t;
+
+static void spinlock_lock_contended(spinlock_t* lock);
+
+spinlock_t* spinlock_create()
+{
+	return HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(spinlock_t));
+}
+
+void spinlock_destroy(spinlock_t* lock)
+{
+	HeapFree(GetProcessHeap(), 0, lock);
+}
+
+void spinlock_lock(spinlock_t* lock)
+{
+	if (atomic_compare_exchange32(&lock->state, k_spinlock_unlocked, k_spinlock_locked, k_atomic_acquire) != k_spinlock_unlocked)
+	{
+		spinlock_lock_contended(lock);
+	}
+}
+
+bool spinlock_try_lock(spinlock_t* lock)
+{
+	return atomic_compare_exchange32(&lock->state, k_spinlock_unlocked, k_spinlock_locked, k_atomic_acquire) == k_spinlock_unlocked;
+}
+
+void spinlock_unlock(spinlock_t* lock)
+{
+	if (atomic_exchange32(&lock->state, k_spinlock_unlocked, k_atomic_release) == k_spinlock_contended)
+	{
+		WakeByAddressSingle((PVOID)&lock->state);
+	}
+}
+
+static void spinlock_lock_contended(spinlock_t* lock)
+{
+	// Double the wait after every failed attempt so contending threads
+	// stop hammering the cache line. Spin on a plain read, only trying
+	// the interlocked operation once the lock looks free.
+	int backoff = 1;
+	for (int round = 0; round < k_spinlock_spin_rounds; ++round)
+	{
+		for (int i = 0; i < backoff; ++i)
+		{
+			YieldProcessor();
+		}
+		if (atomic_load32(&lock->state, k_atomic_relaxed) == k_spinlock_unlocked &&
+			atomic_compare_exchange32(&lock->state, k_spinlock_unlocked, k_spinlock_locked, k_atomic_acquire) == k_spinlock_unlocked)
+		{
+			return;
+		}
+		backoff = __min(backoff * 2, k_spinlock_max_backoff);
+	}
+
+	// Held for a long time: park like mutex_t does.
+	int contended = k_spinlock_contended;
+	while (atomic_exchange32(&lock->state, k_spinlock_contended, k_atomic_acquire) != k_spinlock_unlocked)
+	{
+		WaitOnAddress(&lock->state, &contended, sizeof(contended), INFINITE);
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Non-recursive spinlock thread synchronization
+//
+// For short critical sections. Contended lockers back off exponentially
+// with pause hints, and park the thread only if the lock stays held.
+
+// Handle to a spinlock.
+typedef struct spinlock_t spinlock_t;
+
+// Creates a new spinlock.
+spinlock_t* spinlock_create();
+
+// Destroys a previously created spinlock.
+void spinlock_destroy(spinlock_t* lock);
+
+// Locks a spinlock. A thread must not lock a spinlock it already holds.
+void spinlock_lock(spinlock_t* lock);
+
+// Attempts to lock a spinlock without waiting.
+// Returns true if the lock was taken.
+bool spinlock_try_lock(spinlock_t* lock);
+
+// Unlocks a spinlock.
+void spinlock_unlock(spinlock_t* lock);
@@ -0,0 +1,294 @@
+#include "spsc_ring.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "heap.h"
+
+#include <stdint.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	k_spsc_ring_cache_line = 64,
+
+	// Records start on this boundary.
+	k_spsc_ring_alignment = 8,
+
+	// Polls of the other side's index before a blocking call parks the thread.
+	k_spsc_ring_spin_count = 64,
+};
+
+// Precedes every record in the ring.
+// A padding record fills the end of the buffer when the next record does not fit there;
+// its size is the number of bytes to skip rather than a payload size.
+typedef struct spsc_ring_header_t
+{
+	uint32_t size;
+	uint32_t padding;
+} spsc_ring_header_t;
+
+// Each side owns one cache line holding its published index, its private
+// copy of the other side's index and the flag telling the other side to wake it.
+typedef struct spsc_ring_t
+{
+	heap_t* heap;
+	char* buffer;
+	int64_t capacity;
+	int64_t mask;
+
+	char pad0[k_spsc_ring_cache_line];
+
+	// Written by the producer.
+	volatile int64_t tail;
+	int64_t write_position;
+	int64_t cached_head;
+	volatile int consumer_waiting;
+
+	char pad1[k_spsc_ring_cache_line];
+
+	// Written by the consumer.
+	volatile int64_t head;
+	int64_t read_position;
+	int64_t cached_tail;
+	volatile int producer_waiting;
+
+	char pad2[k_spsc_ring_cache_line];
+} spsc_ring_t;
+
+static void* spsc_ring_reserve(spsc_ring_t* ring, size_t size, bool wait);
+static bool spsc_ring_wait_for_space(spsc_ring_t* ring, int64_t position, int64_t size, bool wait);
+static void* spsc_ring_read(spsc_ring_t* ring, size_t* size, bool wait);
+static bool spsc_ring_wait_for_data(spsc_ring_t* ring, int64_t position, bool wait);
+static int64_t spsc_ring_record_size(size_t size);
+
+spsc_ring_t* spsc_ring_create(heap_t* heap, size_t capacity)
+{
+	int64_t size = k_spsc_ring_cache_line;
+	while (size < (int64_t)capacity)
+	{
+		size <<= 1;
+	}
+
+	spsc_ring_t* ring = heap_alloc(heap, sizeof(spsc_ring_t), k_spsc_ring_cache_line);
+	ring->heap = heap;
+	ring->buffer = heap_alloc(heap, size, k_spsc_ring_cache_line);
+	ring->capacity = size;
+	ring->mask = size - 1;
+	ring->tail = 0;
+	ring->write_position = 0;
+	ring->cached_head = 0;
+	ring->consumer_waiting = 0;
+	ring->head = 0;
+	ring->read_position = 0;
+	ring->cached_tail = 0;
+	ring->producer_waiting = 0;
+	return ring;
+}
+
+void spsc_ring_destroy(spsc_ring_t* ring)
+{
+	heap_free(ring->heap, ring->buffer);
+	heap_free(ring->heap, ring);
+}
+
+void* spsc_ring_write_begin(spsc_ring_t* ring, size_t size)
+{
+	return spsc_ring_reserve(ring, size, true);
+}
+
+void* spsc_ring_try_write_begin(spsc_ring_t* ring, size_t size)
+{
+	return spsc_ring_reserve(ring, size, false);
+}
+
+void spsc_ring_write_end(spsc_ring_t* ring)
+{
+	atomic_store64(&ring->tail, ring->write_position, k_atomic_release);
+	if (atomic_load32(&ring->consumer_waiting, k_atomic_relaxed))
+	{
+		WakeByAddressSingle((PVOID)&ring->tail);
+	}
+}
+
+void* spsc_ring_read_begin(spsc_ring_t* ring, size_t* size)
+{
+	return spsc_ring_read(ring, size, true);
+}
+
+void* spsc_ring_try_read_begin(spsc_ring_t* ring, size_t* size)
+{
+	return spsc_ring_read(ring, size, false);
+}
+
+void spsc_ring_read_end(spsc_ring_t* ring)
+{
+	atomic_store64(&ring->head, ring->read_position, k_atomic_release);
+	if (atomic_load32(&ring->producer_waiting, k_atomic_relaxed))
+	{
+		WakeByAddressSingle((PVOID)&ring->head);
+	}
+}
+
+size_t spsc_ring_get_size(spsc_ring_t* ring)
+{
+	int64_t head = atomic_load64(&ring->head, k_atomic_acquire);
+	int64_t tail = atomic_load64(&ring->tail, k_atomic_acquire);
+	return tail > head ? (size_t)(tail - head) : 0;
+}
+
+static void* spsc_ring_reserve(spsc_ring_t* ring, size_t size, bool wait)
+{
+	int64_t record_size = spsc_ring_record_size(size);
+	if (record_size > ring->capacity)
+	{
+		debug_print(k_print_error, "Record of %zu bytes does not fit in ring buffer!\n", size);
+		return NULL;
+	}
+
+	// Records are contiguous; if this one would straddle the end of the buffer,
+	// publish a padding record over the remainder and start again at the front.
+	int64_t position = ring->tail;
+	int64_t contiguous = ring->capacity - (position & ring->mask);
+	if (record_size > contiguous)
+	{
+		if (!spsc_ring_wait_for_space(ring, position, contiguous, wait))
+		{
+			return NULL;
+		}
+		spsc_ring_header_t* padding = (spsc_ring_header_t*)&ring->buffer[position & ring->mask];
+		padding->size = (uint32_t)contiguous;
+		padding->padding = 1;
+		position += contiguous;
+		ring->write_position = position;
+		spsc_ring_write_end(ring);
+	}
+
+	if (!spsc_ring_wait_for_space(ring, position, record_size, wait))
+	{
+		return NULL;
+	}
+
+	spsc_ring_header_t* header = (spsc_ring_header_t*)&ring->buffer[position & ring->mask];
+	header->size = (uint32_t)size;
+	header->padding = 0;
+	ring->write_position = position + record_size;
+	return header + 1;
+}
+
+static bool spsc_ring_wait_for_space(spsc_ring_t* ring, int64_t position, int64_t size, bool wait)
+{
+	if (ring->capacity - (position - ring->cached_head) >= size)
+	{
+		return true;
+	}
+
+	for (int i = 0; i < k_spsc_ring_spin_count; ++i)
+	{
+		ring->cached_head = atomic_load64(&ring->head, k_atomic_acquire);
+		if (ring->capacity - (position - ring->cached_head) >= size)
+		{
+			return true;
+		}
+		if (!wait)
+		{
+			return false;
+		}
+		YieldProcessor();
+	}
+
+	while (true)
+	{
+		// Raise the flag, then force the consumer's pending stores out so that either
+		// we see its latest head below or its next read end sees the flag and wakes us.
+		// This keeps fences off the consumer's fast path.
+		atomic_store32(&ring->producer_waiting, 1, k_atomic_seq_cst);
+		FlushProcessWriteBuffers();
+		int64_t head = atomic_load64(&ring->head, k_atomic_acquire);
+		if (ring->capacity - (position - head) < size)
+		{
+			WaitOnAddress(&ring->head, &head, sizeof(head), INFINITE);
+		}
+		atomic_store32(&ring->producer_waiting, 0, k_atomic_relaxed);
+
+		ring->cached_head = atomic_load64(&ring->head, k_atomic_acquire);
+		if (ring->capacity - (position - ring->cached_head) >= size)
+		{
+			return true;
+		}
+	}
+}
+
+static void* spsc_ring_read(spsc_ring_t* ring, size_t* size, bool wait)
+{
+	int64_t position = ring->head;
+	while (true)
+	{
+		if (!spsc_ring_wait_for_data(ring, position, wait))
+		{
+			return NULL;
+		}
+
+		spsc_ring_header_t* header = (spsc_ring_header_t*)&ring->buffer[position & ring->mask];
+		if (!header->padding)
+		{
+			*size = header->size;
+			ring->read_position = position + spsc_ring_record_size(header->size);
+			return header + 1;
+		}
+
+		// Padding is published on its own, so hand the space back before
+		// waiting on the record that follows it.
+		position += header->size;
+		ring->read_position = position;
+		spsc_ring_read_end(ring);
+	}
+}
+
+static bool spsc_ring_wait_for_data(spsc_ring_t* ring, int64_t position, bool wait)
+{
+	if (ring->cached_tail != position)
+	{
+		return true;
+	}
+
+	for (int i = 0; i < k_spsc_ring_spin_count; ++i)
+	{
+		ring->cached_tail = atomic_load64(&ring->tail, k_atomic_acquire);
+		if (ring->cached_tail != position)
+		{
+			return true;
+		}
+		if (!wait)
+		{
+			return false;
+		}
+		YieldProcessor();
+	}
+
+	while (true)
+	{
+		// Mirror image of the producer's wait in spsc_ring_wait_for_space.
+		atomic_store32(&ring->consumer_waiting, 1, k_atomic_seq_cst);
+		FlushProcessWriteBuffers();
+		int64_t tail = atomic_load64(&ring->tail, k_atomic_acquire);
+		if (tail == position)
+		{
+			WaitOnAddress(&ring->tail, &tail, sizeof(tail), INFINITE);
+		}
+		atomic_store32(&ring->consumer_waiting, 0, k_atomic_relaxed);
+
+		ring->cached_tail = atomic_load64(&ring->tail, k_atomic_acquire);
+		if (ring->cached_tail != position)
+		{
+			return true;
+		}
+	}
+}
+
+static int64_t spsc_ring_record_size(size_t size)
+{
+	int64_t record_size = sizeof(spsc_ring_header_t) + size;
+	return (record_size + k_spsc_ring_alignment - 1) & ~(int64_t)(k_spsc_ring_alignment - 1);
+}
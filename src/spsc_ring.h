@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Single-producer/single-consumer ring buffer of variable-sized records.
+// Records are written and read in place; the producer and consumer only
+// exchange indices with acquire/release ordering and block only when the
+// ring is full or empty.
+// Exactly one thread may write and exactly one thread may read.
+
+// Handle to a ring buffer.
+typedef struct spsc_ring_t spsc_ring_t;
+
+typedef struct heap_t heap_t;
+
+// Create a ring buffer holding capacity bytes of records.
+// Capacity is rounded up to a power of two.
+spsc_ring_t* spsc_ring_create(heap_t* heap, size_t capacity);
+
+// Destroy a previously created ring buffer.
+void spsc_ring_destroy(spsc_ring_t* ring);
+
+// Reserve space for a record of size bytes and return it for writing.
+// If the ring is full, blocks until the reader frees enough space.
+// Returns NULL if the record can never fit in the ring.
+// The record is not visible to the reader until spsc_ring_write_end.
+void* spsc_ring_write_begin(spsc_ring_t* ring, size_t size);
+
+// Reserve space for a record of size bytes and return it for writing.
+// If the ring is full, returns NULL.
+void* spsc_ring_try_write_begin(spsc_ring_t* ring, size_t size);
+
+// Publish the record reserved by the last write begin call.
+void spsc_ring_write_end(spsc_ring_t* ring);
+
+// Return the oldest record in the ring and store its size.
+// If the ring is empty, blocks until a record is written.
+// The record remains valid until spsc_ring_read_end.
+void* spsc_ring_read_begin(spsc_ring_t* ring, size_t* size);
+
+// Return the oldest record in the ring and store its size.
+// If the ring is empty, returns NULL.
+void* spsc_ring_try_read_begin(spsc_ring_t* ring, size_t* size);
+
+// Release the record returned by the last read begin call back to the writer.
+void spsc_ring_read_end(spsc_ring_t* ring);
+
+// Get the number of bytes of published records, including headers and padding.
+// Only a snapshot unless called from the producer or consumer with the other side idle.
+size_t spsc_ring_get_size(spsc_ring_t* ring);
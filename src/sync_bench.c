@@ -0,0 +1,335 @@
+#include "sync_bench.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "event.h"
+#include "heap.h"
+#include "mutex.h"
+#include "queue.h"
+#include "rwlock.h"
+#include "semaphore.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum
+{
+	// Counter increments performed by each thread in the lock benchmarks.
+	k_sync_bench_ops = 200000,
+
+	// Round trips in the ping-pong benchmarks.
+	k_sync_bench_round_trips = 20000,
+
+	// Items pushed by each producer in the queue benchmark.
+	k_sync_bench_queue_items = 200000,
+	k_sync_bench_queue_capacity = 1024,
+
+	// In the mixed rwlock benchmark, one operation in this many is a write.
+	k_sync_bench_rwlock_write_interval = 10,
+
+	k_sync_bench_max_threads = 64,
+};
+
+typedef struct sync_bench_run_t sync_bench_run_t;
+
+typedef struct sync_bench_thread_t
+{
+	sync_bench_run_t* run;
+	int index;
+} sync_bench_thread_t;
+
+// State shared by the threads of one run. Only the primitives
+// the benchmark function uses are created.
+typedef struct sync_bench_run_t
+{
+	event_t* start;
+	int thread_count;
+	volatile int counter;
+
+	mutex_t* mutex;
+	spinlock_t* spinlock;
+	rwlock_t* rwlock;
+
+	semaphore_t* ping_semaphore;
+	semaphore_t* pong_semaphore;
+	event_t* ping_event;
+	event_t* pong_event;
+
+	queue_t* queue;
+	int producer_count;
+	int consumer_count;
+
+	sync_bench_thread_t threads[k_sync_bench_max_threads];
+} sync_bench_run_t;
+
+typedef struct sync_bench_t
+{
+	const char* name;
+	int (*function)(void*);
+} sync_bench_t;
+
+static void sync_bench_run_one(const char* name, int (*function)(void*), int thread_count,
+	int producer_count, uint64_t op_count);
+static int sync_bench_atomic_func(void* user);
+static int sync_bench_mutex_func(void* user);
+static int sync_bench_spinlock_func(void* user);
+static int sync_bench_rwlock_read_func(void* user);
+static int sync_bench_rwlock_mixed_func(void* user);
+static int sync_bench_semaphore_ping_pong_func(void* user);
+static int sync_bench_event_ping_pong_func(void* user);
+static int sync_bench_queue_func(void* user);
+
+void sync_bench_run(int max_threads)
+{
+	if (max_threads < 1)
+	{
+		max_threads = 1;
+	}
+	if (max_threads > k_sync_bench_max_threads)
+	{
+		max_threads = k_sync_bench_max_threads;
+	}
+
+	debug_print(k_print_info, "benchmark,threads,ops_per_sec,ns_per_op\n");
+
+	sync_bench_t counter_benches[] =
+	{
+		{ "atomic_increment", sync_bench_atomic_func },
+		{ "mutex", sync_bench_mutex_func },
+		{ "spinlock", sync_bench_spinlock_func },
+		{ "rwlock_read", sync_bench_rwlock_read_func },
+		{ "rwlock_mixed", sync_bench_rwlock_mixed_func },
+	};
+	for (int i = 0; i < _countof(counter_benches); ++i)
+	{
+		for (int thread_count = 1; ; thread_count *= 2)
+		{
+			if (thread_count > max_threads)
+			{
+				thread_count = max_threads;
+			}
+			sync_bench_run_one(counter_benches[i].name, counter_benches[i].function, thread_count, 0,
+				(uint64_t)k_sync_bench_ops * thread_count);
+			if (thread_count == max_threads)
+			{
+				break;
+			}
+		}
+	}
+
+	// Ping-pong always takes two threads; each operation is one full round trip.
+	sync_bench_run_one("semaphore_ping_pong", sync_bench_semaphore_ping_pong_func, 2, 0, k_sync_bench_round_trips);
+	sync_bench_run_one("event_ping_pong", sync_bench_event_ping_pong_func, 2, 0, k_sync_bench_round_trips);
+
+	for (int producer_count = 1; producer_count < max_threads || producer_count == 1; producer_count *= 2)
+	{
+		for (int consumer_count = 1; producer_count + consumer_count <= __max(max_threads, 2); consumer_count *= 2)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "queue_%dp_%dc", producer_count, consumer_count);
+			sync_bench_run_one(name, sync_bench_queue_func, producer_count + consumer_count, producer_count,
+				(uint64_t)k_sync_bench_queue_items * producer_count);
+		}
+	}
+}
+
+static void sync_bench_run_one(const char* name, int (*function)(void*), int thread_count,
+	int producer_count, uint64_t op_count)
+{
+	sync_bench_run_t run =
+	{
+		.start = event_create(),
+		.thread_count = thread_count,
+		.counter = 0,
+		.mutex = mutex_create_named("sync_bench"),
+		.spinlock = spinlock_create(),
+		.rwlock = rwlock_create(),
+		.ping_semaphore = semaphore_create(0, 1),
+		.pong_semaphore = semaphore_create(0, 1),
+		.ping_event = event_create_ex(true),
+		.pong_event = event_create_ex(true),
+		.producer_count = producer_count,
+		.consumer_count = thread_count - producer_count,
+	};
+
+	heap_t* heap = heap_create(64 * 1024);
+	run.queue = queue_create(heap, k_sync_bench_queue_capacity);
+
+	thread_t* threads[k_sync_bench_max_threads];
+	for (int i = 0; i < thread_count; ++i)
+	{
+		run.threads[i].run = &run;
+		run.threads[i].index = i;
+		threads[i] = thread_create(function, &run.threads[i]);
+	}
+
+	uint64_t start_ticks = timer_get_ticks();
+	event_signal(run.start);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+	uint64_t duration_ticks = timer_get_ticks() - start_ticks;
+
+	double seconds = (double)duration_ticks / timer_get_ticks_per_second();
+	double ops_per_second = seconds > 0.0 ? (double)op_count / seconds : 0.0;
+	double ns_per_op = op_count ? seconds * 1000000000.0 / (double)op_count : 0.0;
+	debug_print(k_print_info, "%s,%d,%.0f,%.1f\n", name, thread_count, ops_per_second, ns_per_op);
+
+	queue_destroy(run.queue);
+	heap_destroy(heap);
+	event_destroy(run.pong_event);
+	event_destroy(run.ping_event);
+	semaphore_destroy(run.pong_semaphore);
+	semaphore_destroy(run.ping_semaphore);
+	rwlock_destroy(run.rwlock);
+	spinlock_destroy(run.spinlock);
+	mutex_destroy(run.mutex);
+	event_destroy(run.start);
+}
+
+static int sync_bench_atomic_func(void* user)
+{
+	sync_bench_run_t* run = ((sync_bench_thread_t*)user)->run;
+	event_wait(run->start);
+	for (int i = 0; i < k_sync_bench_ops; ++i)
+	{
+		atomic_increment(&run->counter);
+	}
+	return 0;
+}
+
+static int sync_bench_mutex_func(void* user)
+{
+	sync_bench_run_t* run = ((sync_bench_thread_t*)user)->run;
+	event_wait(run->start);
+	for (int i = 0; i < k_sync_bench_ops; ++i)
+	{
+		mutex_lock(run->mutex);
+		run->counter = run->counter + 1;
+		mutex_unlock(run->mutex);
+	}
+	return 0;
+}
+
+static int sync_bench_spinlock_func(void* user)
+{
+	sync_bench_run_t* run = ((sync_bench_thread_t*)user)->run;
+	event_wait(run->start);
+	for (int i = 0; i < k_sync_bench_ops; ++i)
+	{
+		spinlock_lock(run->spinlock);
+		run->counter = run->counter + 1;
+		spinlock_unlock(run->spinlock);
+	}
+	return 0;
+}
+
+static int sync_bench_rwlock_read_func(void* user)
+{
+	sync_bench_run_t* run = ((sync_bench_thread_t*)user)->run;
+	event_wait(run->start);
+	int sum = 0;
+	for (int i = 0; i < k_sync_bench_ops; ++i)
+	{
+		rwlock_lock_read(run->rwlock);
+		sum += run->counter;
+		rwlock_unlock_read(run->rwlock);
+	}
+	return sum;
+}
+
+static int sync_bench_rwlock_mixed_func(void* user)
+{
+	sync_bench_run_t* run = ((sync_bench_thread_t*)user)->run;
+	event_wait(run->start);
+	int sum = 0;
+	for (int i = 0; i < k_sync_bench_ops; ++i)
+	{
+		if (i % k_sync_bench_rwlock_write_interval == 0)
+		{
+			rwlock_lock_write(run->rwlock);
+			run->counter = run->counter + 1;
+			rwlock_unlock_write(run->rwlock);
+		}
+		else
+		{
+			rwlock_lock_read(run->rwlock);
+			sum += run->counter;
+			rwlock_unlock_read(run->rwlock);
+		}
+	}
+	return sum;
+}
+
+static int sync_bench_semaphore_ping_pong_func(void* user)
+{
+	sync_bench_thread_t* thread = user;
+	sync_bench_run_t* run = thread->run;
+	event_wait(run->start);
+	for (int i = 0; i < k_sync_bench_round_trips; ++i)
+	{
+		if (thread->index == 0)
+		{
+			semaphore_release(run->ping_semaphore);
+			semaphore_acquire(run->pong_semaphore);
+		}
+		else
+		{
+			semaphore_acquire(run->ping_semaphore);
+			semaphore_release(run->pong_semaphore);
+		}
+	}
+	return 0;
+}
+
+static int sync_bench_event_ping_pong_func(void* user)
+{
+	sync_bench_thread_t* thread = user;
+	sync_bench_run_t* run = thread->run;
+	event_wait(run->start);
+	for (int i = 0; i < k_sync_bench_round_trips; ++i)
+	{
+		if (thread->index == 0)
+		{
+			event_signal(run->ping_event);
+			event_wait(run->pong_event);
+		}
+		else
+		{
+			event_wait(run->ping_event);
+			event_signal(run->pong_event);
+		}
+	}
+	return 0;
+}
+
+static int sync_bench_queue_func(void* user)
+{
+	sync_bench_thread_t* thread = user;
+	sync_bench_run_t* run = thread->run;
+	event_wait(run->start);
+
+	if (thread->index < run->producer_count)
+	{
+		for (int i = 0; i < k_sync_bench_queue_items; ++i)
+		{
+			queue_push(run->queue, (void*)(uintptr_t)(i + 1));
+		}
+		return 0;
+	}
+
+	// Split the items evenly, handing the remainder to the first consumers.
+	int consumer = thread->index - run->producer_count;
+	int total = k_sync_bench_queue_items * run->producer_count;
+	int count = total / run->consumer_count + (consumer < total % run->consumer_count ? 1 : 0);
+	for (int i = 0; i < count; ++i)
+	{
+		queue_pop(run->queue);
+	}
+	return 0;
+}
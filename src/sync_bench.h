@@ -0,0 +1,12 @@
+#pragma once
+
+// Synchronization primitive benchmarks.
+
+// Runs every synchronization benchmark:
+// contended counter increments under atomics, mutex_t, spinlock_t and rwlock_t,
+// semaphore and event ping-pong between two threads, and queue_t throughput
+// with every mix of producers and consumers.
+// Thread counts go 1, 2, 4, ... up to max_threads.
+// Results are printed as one CSV row per run: benchmark, thread count,
+// operations per second and wall time per operation.
+void sync_bench_run(int max_threads);
@@ -5,18 +5,41 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+enum
+{
+	// Entries in the processor topology we look at; plenty for a 64-processor group.
+	k_thread_topology_capacity = 256,
+};
+
+static void thread_configure(HANDLE h, const char* name, uint64_t affinity_mask, thread_priority_t priority);
+static int thread_get_core_masks(uint64_t* masks, int capacity);
+
 thread_t* thread_create(int (*function)(void*), void* data)
 {
-	HANDLE h = CreateThread(NULL, 0, function, data, CREATE_SUSPENDED, NULL);
-	if (h == INVALID_HANDLE_VALUE)
+	return thread_create_ex(function, data, NULL, 0, k_thread_priority_normal, 0);
+}
+
+thread_t* thread_create_ex(int (*function)(void*), void* data, const char* name,
+	uint64_t affinity_mask, thread_priority_t priority, size_t stack_size)
+{
+	// Start suspended so the thread never runs on the wrong core or at the wrong priority.
+	HANDLE h = CreateThread(NULL, stack_size, function, data,
+		CREATE_SUSPENDED | (stack_size ? STACK_SIZE_PARAM_IS_A_RESERVATION : 0), NULL);
+	if (h == NULL)
 	{
 		debug_print(k_print_warning, "Thread failed to create!\n");
 		return NULL;
 	}
+	thread_configure(h, name, affinity_mask, priority);
 	ResumeThread(h);
 	return (thread_t*)h;
 }
 
+void thread_configure_current(const char* name, uint64_t affinity_mask, thread_priority_t priority)
+{
+	thread_configure(GetCurrentThread(), name, affinity_mask, priority);
+}
+
 int thread_destroy(thread_t* thread)
 {
 	WaitForSingleObject(thread, INFINITE);
@@ -30,3 +53,74 @@ void thread_sleep(uint32_t ms)
 {
 	Sleep(ms);
 }
+
+int thread_get_core_count()
+{
+	uint64_t masks[k_thread_topology_capacity];
+	int count = thread_get_core_masks(masks, k_thread_topology_capacity);
+	return count > 0 ? count : thread_get_logical_core_count();
+}
+
+int thread_get_logical_core_count()
+{
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	return (int)system_info.dwNumberOfProcessors;
+}
+
+uint64_t thread_get_core_affinity(int core)
+{
+	uint64_t masks[k_thread_topology_capacity];
+	int count = thread_get_core_masks(masks, k_thread_topology_capacity);
+	return count > 0 ? masks[core % count] : 0;
+}
+
+static void thread_configure(HANDLE h, const char* name, uint64_t affinity_mask, thread_priority_t priority)
+{
+	if (name)
+	{
+		wchar_t wide_name[256];
+		if (MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, _countof(wide_name)) > 0)
+		{
+			SetThreadDescription(h, wide_name);
+		}
+	}
+
+	if (affinity_mask && !SetThreadAffinityMask(h, (DWORD_PTR)affinity_mask))
+	{
+		debug_print(k_print_warning, "Thread affinity mask %llx rejected!\n", affinity_mask);
+	}
+
+	if (priority != k_thread_priority_normal)
+	{
+		static const int k_priorities[] =
+		{
+			THREAD_PRIORITY_LOWEST,
+			THREAD_PRIORITY_BELOW_NORMAL,
+			THREAD_PRIORITY_NORMAL,
+			THREAD_PRIORITY_ABOVE_NORMAL,
+			THREAD_PRIORITY_HIGHEST,
+		};
+		SetThreadPriority(h, k_priorities[priority]);
+	}
+}
+
+static int thread_get_core_masks(uint64_t* masks, int capacity)
+{
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION info[k_thread_topology_capacity];
+	DWORD size = sizeof(info);
+	if (!GetLogicalProcessorInformation(info, &size))
+	{
+		return 0;
+	}
+
+	int count = 0;
+	for (DWORD i = 0; i < size / sizeof(info[0]) && count < capacity; ++i)
+	{
+		if (info[i].Relationship == RelationProcessorCore)
+		{
+			masks[count++] = (uint64_t)info[i].ProcessorMask;
+		}
+	}
+	return count;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 // Threading support.
@@ -7,14 +8,48 @@
 // Handle to a thread.
 typedef struct thread_t thread_t;
 
+// Scheduling priority of a thread relative to others in the process.
+typedef enum thread_priority_t
+{
+	k_thread_priority_lowest,
+	k_thread_priority_low,
+	k_thread_priority_normal,
+	k_thread_priority_high,
+	k_thread_priority_highest,
+} thread_priority_t;
+
 // Creates a new thread.
 // Thread begins running function with data on return.
 thread_t* thread_create(int (*function)(void*), void* data);
 
+// Creates a new thread with the given name, affinity, priority and stack size.
+// The name shows up in debuggers and profilers; NULL leaves the thread unnamed.
+// The affinity mask has one bit per logical processor; zero lets the thread run anywhere.
+// A stack size of zero uses the executable's default.
+// Thread begins running function with data on return.
+thread_t* thread_create_ex(int (*function)(void*), void* data, const char* name,
+	uint64_t affinity_mask, thread_priority_t priority, size_t stack_size);
+
+// Applies a name, affinity mask and priority to the calling thread.
+// Arguments mean the same as for thread_create_ex.
+void thread_configure_current(const char* name, uint64_t affinity_mask, thread_priority_t priority);
+
 // Waits for a thread to complete and destroys it.
 // Returns the thread's exit code.
-int thread_destroy(thread);
+int thread_destroy(thread_t* thread);
 
 // Puts the calling thread to sleep for the specified number of milliseconds.
 // Thread will sleep for *approximately* the specified time.
 void thread_sleep(uint32_t ms);
+
+// Gets the number of physical cores in the machine.
+int thread_get_core_count();
+
+// Gets the number of logical processors in the machine.
+// Higher than the core count when cores run more than one hardware thread.
+int thread_get_logical_core_count();
+
+// Gets an affinity mask covering every logical processor on a physical core.
+// Core indices wrap around the core count.
+// Returns zero, meaning no restriction, if the topology cannot be queried.
+uint64_t thread_get_core_affinity(int core);
@@ -1041,6 +1041,41 @@ void tlsf_remove_pool(tlsf_t tlsf, pool_t pool)
 	remove_free_block(control, block, fl, sl);
 }
 
+int tlsf_extend_pool(tlsf_t tlsf, pool_t pool, size_t bytes, size_t new_bytes)
+{
+	block_header_t* block;
+	block_header_t* next;
+
+	const size_t pool_overhead = tlsf_pool_overhead();
+	const size_t pool_bytes = align_down(bytes - pool_overhead, ALIGN_SIZE);
+	const size_t new_pool_bytes = align_down(new_bytes - pool_overhead, ALIGN_SIZE);
+
+	if (new_pool_bytes > block_size_max ||
+		new_pool_bytes < pool_bytes + block_header_overhead + block_size_min)
+	{
+		printf("tlsf_extend_pool: Pool cannot grow from %u to %u bytes.\n",
+			(unsigned int)bytes, (unsigned int)new_bytes);
+		return 0;
+	}
+
+	/*
+	** The old sentinel becomes a used block covering the new memory,
+	** followed by a new sentinel. Freeing it merges it with any free
+	** block at the end of the pool.
+	*/
+	block = offset_to_block(pool, pool_bytes);
+	tlsf_assert(block_is_last(block) && "pool size does not match sentinel");
+	block_set_size(block, new_pool_bytes - pool_bytes - block_header_overhead);
+
+	next = block_link_next(block);
+	next->size = 0;
+	block_set_used(next);
+	block_set_prev_used(next);
+
+	tlsf_free(tlsf, block_to_ptr(block));
+	return 1;
+}
+
 /*
 ** TLSF main interface.
 */
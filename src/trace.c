@@ -1,33 +1,962 @@
 #include "trace.h"
 
+#include "atomic.h"
+#include "debug.h"
+#include "event.h"
+#include "fs.h"
+#include "heap.h"
+#include "thread.h"
+#include "timer.h"
+#include "trace_binary.h"
+
+#include "lz4/lz4.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	k_trace_cache_line = 64,
+
+	// Threads that can record events over the lifetime of a trace.
+	k_trace_max_threads = 64,
+
+	// Nesting levels tracked per thread; deeper durations are not recorded.
+	k_trace_max_depth = 64,
+
+	k_trace_path_size = 1024,
+	k_trace_write_buffer_size = 64 * 1024,
+
+	// Binary captures drain the rings this often, so rings only need to hold a few frames.
+	k_trace_stream_interval_ms = 10,
+
+	// Uncompressed payload of a binary block.
+	k_trace_block_size = 64 * 1024,
+
+	// Encoded blocks waiting on the file system; when all are in flight the writer waits.
+	k_trace_stream_output_count = 4,
+
+	// Longest name stored in a binary capture; longer names are truncated.
+	k_trace_max_name_length = 256,
+
+	// Largest encoded event: a counter's record type, tick delta, name id and value.
+	k_trace_max_record_size = 1 + 10 + 5 + 10,
+};
+
+typedef enum trace_event_type_t
+{
+	k_trace_event_begin,
+	k_trace_event_end,
+	k_trace_event_counter,
+} trace_event_type_t;
+
+// Fixed-size record written by trace_duration_push, trace_duration_pop and trace_counter_set.
+typedef struct trace_event_t
+{
+	const char* name;
+	uint64_t ticks;
+	int64_t value;
+	uint32_t thread_id;
+	uint32_t type;
+} trace_event_t;
+
+// Single-producer/single-consumer ring of events, one per thread.
+// The owning thread is the only one to write events and advance tail; the capture
+// calls and the writer thread are the only ones to advance head.
+// A full ring drops new durations rather than blocking or overwriting.
+typedef struct trace_thread_t
+{
+	trace_event_t* events;
+	uint32_t thread_id;
+
+	// Touched only by the owning thread.
+	// Bit n of recorded is set when the duration at depth n had its begin recorded.
+	// Every recorded begin keeps a slot free for its end so captures stay balanced.
+	int depth;
+	int open;
+	uint64_t recorded;
+
+	// Fiber that began the duration at each depth, NULL off fibers.
+	void* fibers[k_trace_max_depth];
+
+	char pad0[k_trace_cache_line];
+	volatile int64_t tail;
+	volatile int64_t dropped;
+	char pad1[k_trace_cache_line - 2 * sizeof(int64_t)];
+	volatile int64_t head;
+	char pad2[k_trace_cache_line - sizeof(int64_t)];
+} trace_thread_t;
+
+typedef struct trace_t
+{
+	heap_t* heap;
+	int64_t capacity;
+	int64_t mask;
+	DWORD thread_tls;
+
+	volatile int capturing;
+	volatile int thread_count;
+	volatile int warned_fiber_mismatch;
+	trace_thread_t* volatile threads[k_trace_max_threads];
+
+	// Capture state, owned by the capture calls and then handed to the writer thread.
+	thread_t* writer;
+	event_t* stop_event;
+	trace_format_t format;
+	fs_t* fs;
+	bool use_compression;
+	char path[k_trace_path_size];
+	uint64_t start_ticks;
+	uint64_t stop_ticks;
+	int stop_thread_count;
+	int64_t stop_tails[k_trace_max_threads];
+	int64_t start_dropped[k_trace_max_threads];
+} trace_t;
+
+// Buffered output of the writer thread.
+typedef struct trace_writer_t
+{
+	HANDLE handle;
+	char* buffer;
+	size_t size;
+	bool failed;
+} trace_writer_t;
+
+// Per-thread block being encoded by a binary capture.
+typedef struct trace_stream_thread_t
+{
+	uint8_t* block;
+	size_t size;
+	uint64_t base_ticks;
+	uint64_t last_ticks;
+	int depth;
+} trace_stream_thread_t;
+
+// Writer thread state for a binary capture.
+// Names are interned by pointer in an open addressing table.
+typedef struct trace_stream_t
+{
+	const char** names;
+	uint32_t* name_ids;
+	uint32_t name_capacity;
+	uint32_t name_count;
+	uint8_t* name_block;
+	size_t name_block_size;
+
+	trace_stream_thread_t threads[k_trace_max_threads];
+
+	uint8_t* outputs[k_trace_stream_output_count];
+	fs_work_t* output_work[k_trace_stream_output_count];
+	int next_output;
+	bool failed;
+} trace_stream_t;
+
+// Stored in a thread's TLS slot while it registers, and for good once slots run out,
+// so that durations traced from inside registration or from excess threads are ignored.
+static trace_thread_t s_trace_thread_unavailable;
+
+static trace_thread_t* trace_register_thread(trace_t* trace);
+static void* trace_get_fiber();
+static bool trace_write_event(trace_t* trace, trace_thread_t* thread, const char* name, trace_event_type_t type, int64_t value, int64_t reserve);
+static void trace_snapshot_tails(trace_t* trace);
+static int trace_writer_thread_func(void* user);
+static void trace_writer_chrome_json(trace_t* trace, trace_writer_t* writer);
+static int trace_stream_thread_func(void* user);
+static void trace_stream_drain(trace_t* trace, trace_stream_t* stream, bool final);
+static void trace_stream_event(trace_t* trace, trace_stream_t* stream, trace_stream_thread_t* state,
+	uint32_t thread_id, trace_binary_record_t record, const char* name, uint64_t ticks, int64_t value);
+static uint32_t trace_stream_intern(trace_t* trace, trace_stream_t* stream, const char* name);
+static void trace_stream_grow_names(trace_t* trace, trace_stream_t* stream);
+static void trace_stream_flush_thread(trace_t* trace, trace_stream_t* stream, trace_stream_thread_t* state, uint32_t thread_id);
+static void trace_stream_flush_names(trace_t* trace, trace_stream_t* stream);
+static void trace_stream_emit(trace_t* trace, trace_stream_t* stream, trace_binary_block_type_t type,
+	uint32_t thread_id, uint64_t base_ticks, const uint8_t* payload, size_t size);
+static size_t trace_write_varint(uint8_t* buffer, uint64_t value);
+static void trace_report_dropped(trace_t* trace);
+static void trace_writer_printf(trace_writer_t* writer, const char* format, ...);
+static void trace_writer_append_string(trace_writer_t* writer, const char* string);
+static void trace_writer_flush(trace_writer_t* writer);
+static double trace_ticks_to_us(uint64_t ticks);
+static void trace_wait_for_writer(trace_t* trace);
 
 trace_t* trace_create(heap_t* heap, int event_capacity)
 {
-	return NULL;
+	// Each duration takes a begin and an end event.
+	int64_t capacity = 2;
+	while (capacity < (int64_t)event_capacity * 2)
+	{
+		capacity <<= 1;
+	}
+
+	trace_t* trace = heap_alloc(heap, sizeof(trace_t), k_trace_cache_line);
+	memset(trace, 0, sizeof(trace_t));
+	trace->heap = heap;
+	trace->capacity = capacity;
+	trace->mask = capacity - 1;
+	trace->thread_tls = TlsAlloc();
+	trace->stop_event = event_create();
+	return trace;
 }
 
 void trace_destroy(trace_t* trace)
 {
+	if (!trace)
+	{
+		return;
+	}
 
+	trace_capture_stop(trace);
+	trace_wait_for_writer(trace);
+
+	int thread_count = __min(atomic_load32(&trace->thread_count, k_atomic_acquire), k_trace_max_threads);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		trace_thread_t* thread = atomic_load_ptr((void* volatile*)&trace->threads[i], k_atomic_acquire);
+		if (thread)
+		{
+			heap_free(trace->heap, thread->events);
+			heap_free(trace->heap, thread);
+		}
+	}
+	event_destroy(trace->stop_event);
+	TlsFree(trace->thread_tls);
+	heap_free(trace->heap, trace);
 }
 
 void trace_duration_push(trace_t* trace, const char* name)
 {
+	trace_thread_t* thread = TlsGetValue(trace->thread_tls);
+	if (!thread)
+	{
+		// Threads register on their first duration during a capture.
+		if (!atomic_load32(&trace->capturing, k_atomic_relaxed))
+		{
+			return;
+		}
+		thread = trace_register_thread(trace);
+	}
+	if (thread == &s_trace_thread_unavailable)
+	{
+		return;
+	}
+
+	int depth = thread->depth++;
+	if (depth >= k_trace_max_depth)
+	{
+		return;
+	}
+	thread->fibers[depth] = trace_get_fiber();
 
+	// Reserve room for this duration's end along with those of the durations it is nested in.
+	uint64_t bit = 1ull << depth;
+	if (atomic_load32(&trace->capturing, k_atomic_relaxed) &&
+		trace_write_event(trace, thread, name, k_trace_event_begin, 0, thread->open + 2))
+	{
+		thread->recorded |= bit;
+		thread->open++;
+	}
+	else
+	{
+		thread->recorded &= ~bit;
+	}
 }
 
 void trace_duration_pop(trace_t* trace)
 {
+	trace_thread_t* thread = TlsGetValue(trace->thread_tls);
+	if (!thread || thread == &s_trace_thread_unavailable || thread->depth <= 0)
+	{
+		return;
+	}
 
+	int depth = thread->depth - 1;
+	if (depth < k_trace_max_depth && thread->fibers[depth] != trace_get_fiber())
+	{
+		// A job began this duration and parked in job_wait, or this job began
+		// its duration on another thread; either way it is not ours to end.
+		if (!atomic_exchange32(&trace->warned_fiber_mismatch, 1, k_atomic_relaxed))
+		{
+			debug_print(k_print_warning, "Trace duration ended on a different thread or fiber than it began; see trace.h.\n");
+		}
+		return;
+	}
+	thread->depth = depth;
+	if (depth >= k_trace_max_depth)
+	{
+		return;
+	}
+
+	// Ends are written even if the capture has stopped in between; the writer
+	// closes durations still open at the stop and skips ends it has no begin for.
+	uint64_t bit = 1ull << depth;
+	if (thread->recorded & bit)
+	{
+		trace_write_event(trace, thread, NULL, k_trace_event_end, 0, 1);
+		thread->recorded &= ~bit;
+		thread->open--;
+	}
+}
+
+void trace_counter_set(trace_t* trace, const char* name, int64_t value)
+{
+	if (!atomic_load32(&trace->capturing, k_atomic_relaxed))
+	{
+		return;
+	}
+
+	trace_thread_t* thread = TlsGetValue(trace->thread_tls);
+	if (!thread)
+	{
+		thread = trace_register_thread(trace);
+	}
+	if (thread == &s_trace_thread_unavailable)
+	{
+		return;
+	}
+
+	// Counters must not take the room held for the ends of open durations.
+	trace_write_event(trace, thread, name, k_trace_event_counter, value, thread->open + 1);
 }
 
 void trace_capture_start(trace_t* trace, const char* path)
 {
+	trace_capture_start_ex(trace, path, k_trace_format_chrome_json, NULL, false);
+}
+
+void trace_capture_start_ex(trace_t* trace, const char* path, trace_format_t format, fs_t* fs, bool use_compression)
+{
+	if (atomic_load32(&trace->capturing, k_atomic_relaxed))
+	{
+		debug_print(k_print_warning, "Trace capture already running!\n");
+		return;
+	}
+	if (format == k_trace_format_binary && !fs)
+	{
+		debug_print(k_print_error, "Binary trace capture needs a file system!\n");
+		return;
+	}
+
+	// The previous capture's file must be written before its rings are reused.
+	trace_wait_for_writer(trace);
 
+	strcpy_s(trace->path, sizeof(trace->path), path);
+	trace->format = format;
+	trace->fs = fs;
+	trace->use_compression = use_compression;
+
+	// Discard anything recorded since the last capture.
+	int thread_count = __min(atomic_load32(&trace->thread_count, k_atomic_acquire), k_trace_max_threads);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		trace_thread_t* thread = atomic_load_ptr((void* volatile*)&trace->threads[i], k_atomic_acquire);
+		if (thread)
+		{
+			atomic_store64(&thread->head, atomic_load64(&thread->tail, k_atomic_acquire), k_atomic_release);
+			trace->start_dropped[i] = atomic_load64(&thread->dropped, k_atomic_relaxed);
+		}
+	}
+
+	trace->start_ticks = timer_get_ticks();
+	atomic_store32(&trace->capturing, 1, k_atomic_release);
+
+	// Binary captures stream out while running so they never need more than the rings.
+	if (format == k_trace_format_binary)
+	{
+		event_reset(trace->stop_event);
+		trace->writer = thread_create_ex(trace_stream_thread_func, trace, "trace writer", 0, k_thread_priority_low, 0);
+	}
 }
 
 void trace_capture_stop(trace_t* trace)
 {
+	if (!atomic_load32(&trace->capturing, k_atomic_relaxed))
+	{
+		return;
+	}
+	atomic_store32(&trace->capturing, 0, k_atomic_release);
+	trace->stop_ticks = timer_get_ticks();
+
+	trace_snapshot_tails(trace);
+
+	if (trace->format == k_trace_format_binary)
+	{
+		event_signal(trace->stop_event);
+	}
+	else
+	{
+		// Formatting a large capture takes a while, so it happens off the calling thread.
+		trace->writer = thread_create_ex(trace_writer_thread_func, trace, "trace writer", 0, k_thread_priority_low, 0);
+	}
+}
+
+static trace_thread_t* trace_register_thread(trace_t* trace)
+{
+	TlsSetValue(trace->thread_tls, &s_trace_thread_unavailable);
+
+	int index = atomic_fetch_add32(&trace->thread_count, 1, k_atomic_relaxed);
+	if (index >= k_trace_max_threads)
+	{
+		debug_print(k_print_warning, "Trace thread limit of %d reached; thread %u will not be traced.\n",
+			k_trace_max_threads, GetCurrentThreadId());
+		return &s_trace_thread_unavailable;
+	}
+
+	trace_thread_t* thread = heap_alloc(trace->heap, sizeof(trace_thread_t), k_trace_cache_line);
+	trace_event_t* events = heap_alloc(trace->heap, sizeof(trace_event_t) * trace->capacity, k_trace_cache_line);
+	if (!thread || !events)
+	{
+		debug_print(k_print_error, "Out of memory for trace events; thread %u will not be traced.\n",
+			GetCurrentThreadId());
+		heap_free(trace->heap, events);
+		heap_free(trace->heap, thread);
+		return &s_trace_thread_unavailable;
+	}
+	memset(thread, 0, sizeof(trace_thread_t));
+	thread->events = events;
+	thread->thread_id = GetCurrentThreadId();
+
+	atomic_store_ptr((void* volatile*)&trace->threads[index], thread, k_atomic_release);
+	TlsSetValue(trace->thread_tls, thread);
+	return thread;
+}
+
+static void* trace_get_fiber()
+{
+	return IsThreadAFiber() ? GetCurrentFiber() : NULL;
+}
+
+static bool trace_write_event(trace_t* trace, trace_thread_t* thread, const char* name, trace_event_type_t type, int64_t value, int64_t reserve)
+{
+	int64_t tail = thread->tail;
+	int64_t head = atomic_load64(&thread->head, k_atomic_acquire);
+	if (tail - head + reserve > trace->capacity)
+	{
+		atomic_store64(&thread->dropped, thread->dropped + 1, k_atomic_relaxed);
+		return false;
+	}
+
+	trace_event_t* event = &thread->events[tail & trace->mask];
+	event->name = name;
+	event->ticks = timer_get_ticks();
+	event->value = value;
+	event->thread_id = thread->thread_id;
+	event->type = type;
+	atomic_store64(&thread->tail, tail + 1, k_atomic_release);
+	return true;
+}
+
+static void trace_snapshot_tails(trace_t* trace)
+{
+	// Events written after this belong to no capture.
+	trace->stop_thread_count = __min(atomic_load32(&trace->thread_count, k_atomic_acquire), k_trace_max_threads);
+	for (int i = 0; i < trace->stop_thread_count; ++i)
+	{
+		trace_thread_t* thread = atomic_load_ptr((void* volatile*)&trace->threads[i], k_atomic_acquire);
+		trace->stop_tails[i] = thread ? atomic_load64(&thread->tail, k_atomic_acquire) : 0;
+	}
+}
+
+static int trace_writer_thread_func(void* user)
+{
+	trace_t* trace = user;
+
+	wchar_t wide_path[k_trace_path_size];
+	if (MultiByteToWideChar(CP_UTF8, 0, trace->path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		debug_print(k_print_error, "Invalid trace path: %s\n", trace->path);
+		return -1;
+	}
+
+	trace_writer_t writer =
+	{
+		.handle = CreateFile(wide_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL),
+		.size = 0,
+		.failed = false,
+	};
+	if (writer.handle == INVALID_HANDLE_VALUE)
+	{
+		debug_print(k_print_error, "Unable to open trace file: %s\n", trace->path);
+		return -1;
+	}
+	writer.buffer = heap_alloc(trace->heap, k_trace_write_buffer_size, 8);
+
+	trace_writer_chrome_json(trace, &writer);
+
+	trace_writer_flush(&writer);
+	heap_free(trace->heap, writer.buffer);
+	CloseHandle(writer.handle);
+
+	trace_report_dropped(trace);
+	if (writer.failed)
+	{
+		debug_print(k_print_error, "Unable to write trace file: %s\n", trace->path);
+		return -1;
+	}
+	return 0;
+}
+
+static void trace_writer_chrome_json(trace_t* trace, trace_writer_t* writer)
+{
+	DWORD process_id = GetCurrentProcessId();
+	bool first = true;
+
+	trace_writer_printf(writer, "{\"displayTimeUnits\":\"ns\",\"traceEvents\":[");
+	for (int i = 0; i < trace->stop_thread_count; ++i)
+	{
+		trace_thread_t* thread = atomic_load_ptr((void* volatile*)&trace->threads[i], k_atomic_acquire);
+		if (!thread)
+		{
+			continue;
+		}
+
+		int depth = 0;
+		int64_t head = atomic_load64(&thread->head, k_atomic_acquire);
+		for (int64_t position = head; position < trace->stop_tails[i]; ++position)
+		{
+			trace_event_t* event = &thread->events[position & trace->mask];
+			if (event->type == k_trace_event_begin)
+			{
+				trace_writer_printf(writer, "%s\n{\"name\":\"", first ? "" : ",");
+				trace_writer_append_string(writer, event->name);
+				trace_writer_printf(writer, "\",\"ph\":\"B\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+					process_id, event->thread_id, trace_ticks_to_us(event->ticks - trace->start_ticks));
+				depth++;
+				first = false;
+			}
+			else if (event->type == k_trace_event_counter)
+			{
+				trace_writer_printf(writer, "%s\n{\"name\":\"", first ? "" : ",");
+				trace_writer_append_string(writer, event->name);
+				trace_writer_printf(writer, "\",\"ph\":\"C\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%lld}}",
+					process_id, event->thread_id, trace_ticks_to_us(event->ticks - trace->start_ticks), event->value);
+				first = false;
+			}
+			else if (depth > 0)
+			{
+				trace_writer_printf(writer, "%s\n{\"ph\":\"E\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+					first ? "" : ",", process_id, event->thread_id, trace_ticks_to_us(event->ticks - trace->start_ticks));
+				depth--;
+				first = false;
+			}
+		}
+
+		// Close durations still running when the capture stopped.
+		for (; depth > 0; --depth)
+		{
+			trace_writer_printf(writer, "%s\n{\"ph\":\"E\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+				first ? "" : ",", process_id, thread->thread_id, trace_ticks_to_us(trace->stop_ticks - trace->start_ticks));
+			first = false;
+		}
+
+		atomic_store64(&thread->head, trace->stop_tails[i], k_atomic_release);
+	}
+	trace_writer_printf(writer, "\n]}\n");
+}
+
+static int trace_stream_thread_func(void* user)
+{
+	trace_t* trace = user;
+
+	trace_stream_t* stream = heap_alloc(trace->heap, sizeof(trace_stream_t), 8);
+	memset(stream, 0, sizeof(trace_stream_t));
+	stream->name_capacity = 1024;
+	stream->names = heap_alloc(trace->heap, sizeof(const char*) * stream->name_capacity, 8);
+	memset(stream->names, 0, sizeof(const char*) * stream->name_capacity);
+	stream->name_ids = heap_alloc(trace->heap, sizeof(uint32_t) * stream->name_capacity, 8);
+	stream->name_block = heap_alloc(trace->heap, k_trace_block_size, 8);
+	for (int i = 0; i < k_trace_stream_output_count; ++i)
+	{
+		stream->outputs[i] = heap_alloc(trace->heap, sizeof(trace_binary_block_t) + LZ4_compressBound(k_trace_block_size), 8);
+	}
+	for (int i = 0; i < k_trace_max_threads; ++i)
+	{
+		stream->threads[i].base_ticks = trace->start_ticks;
+		stream->threads[i].last_ticks = trace->start_ticks;
+	}
+
+	// The header creates the file; blocks are appended behind it in queue order.
+	trace_binary_header_t* header = (trace_binary_header_t*)stream->outputs[0];
+	header->magic = TRACE_BINARY_MAGIC;
+	header->version = TRACE_BINARY_VERSION;
+	header->ticks_per_second = timer_get_ticks_per_second();
+	header->start_ticks = trace->start_ticks;
+	header->process_id = GetCurrentProcessId();
+	header->reserved = 0;
+	stream->output_work[0] = fs_write(trace->fs, trace->path, header, sizeof(trace_binary_header_t), false);
+	stream->next_output = 1;
+
+	while (!event_wait_timeout(trace->stop_event, k_trace_stream_interval_ms))
+	{
+		trace_stream_drain(trace, stream, false);
+	}
+	trace_stream_drain(trace, stream, true);
+
+	for (int i = 0; i < k_trace_stream_output_count; ++i)
+	{
+		if (stream->output_work[i])
+		{
+			if (fs_work_get_result(stream->output_work[i]) != 0)
+			{
+				stream->failed = true;
+			}
+			fs_work_destroy(stream->output_work[i]);
+		}
+		heap_free(trace->heap, stream->outputs[i]);
+	}
+	for (int i = 0; i < k_trace_max_threads; ++i)
+	{
+		if (stream->threads[i].block)
+		{
+			heap_free(trace->heap, stream->threads[i].block);
+		}
+	}
+	heap_free(trace->heap, stream->name_block);
+	heap_free(trace->heap, stream->name_ids);
+	heap_free(trace->heap, stream->names);
+
+	bool failed = stream->failed;
+	heap_free(trace->heap, stream);
+
+	trace_report_dropped(trace);
+	if (failed)
+	{
+		debug_print(k_print_error, "Unable to write trace file: %s\n", trace->path);
+		return -1;
+	}
+	return 0;
+}
+
+static void trace_stream_drain(trace_t* trace, trace_stream_t* stream, bool final)
+{
+	int thread_count = __min(atomic_load32(&trace->thread_count, k_atomic_acquire), k_trace_max_threads);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		trace_thread_t* thread = atomic_load_ptr((void* volatile*)&trace->threads[i], k_atomic_acquire);
+		if (!thread)
+		{
+			continue;
+		}
+
+		// The final drain stops at the snapshot taken by trace_capture_stop.
+		int64_t head = atomic_load64(&thread->head, k_atomic_relaxed);
+		int64_t tail = atomic_load64(&thread->tail, k_atomic_acquire);
+		if (final)
+		{
+			tail = i < trace->stop_thread_count ? __max(trace->stop_tails[i], head) : head;
+		}
+
+		trace_stream_thread_t* state = &stream->threads[i];
+		for (int64_t position = head; position < tail; ++position)
+		{
+			trace_event_t* event = &thread->events[position & trace->mask];
+			trace_binary_record_t record =
+				event->type == k_trace_event_begin ? k_trace_binary_record_begin :
+				event->type == k_trace_event_end ? k_trace_binary_record_end :
+				k_trace_binary_record_counter;
+			trace_stream_event(trace, stream, state, thread->thread_id, record, event->name, event->ticks, event->value);
+		}
+		atomic_store64(&thread->head, tail, k_atomic_release);
+
+		if (final)
+		{
+			// Close durations still running when the capture stopped.
+			while (state->depth > 0)
+			{
+				trace_stream_event(trace, stream, state, thread->thread_id, k_trace_binary_record_end, NULL, trace->stop_ticks, 0);
+			}
+			trace_stream_flush_thread(trace, stream, state, thread->thread_id);
+		}
+	}
+
+	if (final)
+	{
+		trace_stream_flush_names(trace, stream);
+	}
+}
+
+static void trace_stream_event(trace_t* trace, trace_stream_t* stream, trace_stream_thread_t* state,
+	uint32_t thread_id, trace_binary_record_t record, const char* name, uint64_t ticks, int64_t value)
+{
+	uint32_t name_id = 0;
+	if (record == k_trace_binary_record_counter)
+	{
+		name_id = trace_stream_intern(trace, stream, name);
+	}
+	else if (record == k_trace_binary_record_begin)
+	{
+		name_id = trace_stream_intern(trace, stream, name);
+		state->depth++;
+	}
+	else if (state->depth > 0)
+	{
+		state->depth--;
+	}
+	else
+	{
+		// Its begin was recorded before this capture started.
+		return;
+	}
+
+	if (!state->block)
+	{
+		state->block = heap_alloc(trace->heap, k_trace_block_size, 8);
+	}
+	if (state->size + k_trace_max_record_size > k_trace_block_size)
+	{
+		trace_stream_flush_thread(trace, stream, state, thread_id);
+	}
+
+	uint64_t delta = ticks > state->last_ticks ? ticks - state->last_ticks : 0;
+	state->last_ticks += delta;
+
+	state->block[state->size++] = (uint8_t)record;
+	state->size += trace_write_varint(state->block + state->size, delta);
+	if (record != k_trace_binary_record_end)
+	{
+		state->size += trace_write_varint(state->block + state->size, name_id);
+	}
+	if (record == k_trace_binary_record_counter)
+	{
+		// Zigzag so small negative values stay small.
+		state->size += trace_write_varint(state->block + state->size, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+	}
+}
+
+static uint32_t trace_stream_intern(trace_t* trace, trace_stream_t* stream, const char* name)
+{
+	name = name ? name : "";
+
+	if ((stream->name_count + 1) * 2 > stream->name_capacity)
+	{
+		trace_stream_grow_names(trace, stream);
+	}
+
+	// Names are string literals or otherwise live as long as the trace, so the pointer is the key.
+	uint32_t mask = stream->name_capacity - 1;
+	uint32_t slot = (uint32_t)(((uintptr_t)name >> 3) * 2654435761u) & mask;
+	while (stream->names[slot])
+	{
+		if (stream->names[slot] == name)
+		{
+			return stream->name_ids[slot];
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	uint32_t id = stream->name_count++;
+	stream->names[slot] = name;
+	stream->name_ids[slot] = id;
+
+	size_t length = strnlen(name, k_trace_max_name_length);
+	if (stream->name_block_size + 10 + length > k_trace_block_size)
+	{
+		trace_stream_flush_names(trace, stream);
+	}
+	stream->name_block_size += trace_write_varint(stream->name_block + stream->name_block_size, id);
+	stream->name_block_size += trace_write_varint(stream->name_block + stream->name_block_size, length);
+	memcpy(stream->name_block + stream->name_block_size, name, length);
+	stream->name_block_size += length;
+	return id;
+}
+
+static void trace_stream_grow_names(trace_t* trace, trace_stream_t* stream)
+{
+	uint32_t old_capacity = stream->name_capacity;
+	const char** old_names = stream->names;
+	uint32_t* old_ids = stream->name_ids;
 
+	stream->name_capacity = old_capacity * 2;
+	stream->names = heap_alloc(trace->heap, sizeof(const char*) * stream->name_capacity, 8);
+	memset(stream->names, 0, sizeof(const char*) * stream->name_capacity);
+	stream->name_ids = heap_alloc(trace->heap, sizeof(uint32_t) * stream->name_capacity, 8);
+
+	uint32_t mask = stream->name_capacity - 1;
+	for (uint32_t i = 0; i < old_capacity; ++i)
+	{
+		if (old_names[i])
+		{
+			uint32_t slot = (uint32_t)(((uintptr_t)old_names[i] >> 3) * 2654435761u) & mask;
+			while (stream->names[slot])
+			{
+				slot = (slot + 1) & mask;
+			}
+			stream->names[slot] = old_names[i];
+			stream->name_ids[slot] = old_ids[i];
+		}
+	}
+
+	heap_free(trace->heap, old_ids);
+	heap_free(trace->heap, old_names);
+}
+
+static void trace_stream_flush_thread(trace_t* trace, trace_stream_t* stream, trace_stream_thread_t* state, uint32_t thread_id)
+{
+	if (!state->size)
+	{
+		return;
+	}
+
+	// Names used by the block must land in the file ahead of it.
+	trace_stream_flush_names(trace, stream);
+
+	trace_stream_emit(trace, stream, k_trace_binary_block_events, thread_id, state->base_ticks, state->block, state->size);
+	state->size = 0;
+	state->base_ticks = state->last_ticks;
+}
+
+static void trace_stream_flush_names(trace_t* trace, trace_stream_t* stream)
+{
+	if (stream->name_block_size)
+	{
+		trace_stream_emit(trace, stream, k_trace_binary_block_names, 0, 0, stream->name_block, stream->name_block_size);
+		stream->name_block_size = 0;
+	}
+}
+
+static void trace_stream_emit(trace_t* trace, trace_stream_t* stream, trace_binary_block_type_t type,
+	uint32_t thread_id, uint64_t base_ticks, const uint8_t* payload, size_t size)
+{
+	// Reuse the oldest output buffer once the file system is done with it.
+	int index = stream->next_output;
+	stream->next_output = (index + 1) % k_trace_stream_output_count;
+	if (stream->output_work[index])
+	{
+		if (fs_work_get_result(stream->output_work[index]) != 0)
+		{
+			stream->failed = true;
+		}
+		fs_work_destroy(stream->output_work[index]);
+		stream->output_work[index] = NULL;
+	}
+
+	trace_binary_block_t* block = (trace_binary_block_t*)stream->outputs[index];
+	uint8_t* data = (uint8_t*)(block + 1);
+	block->type = type;
+	block->thread_id = thread_id;
+	block->flags = 0;
+	block->raw_size = (uint32_t)size;
+	block->reserved = 0;
+	block->base_ticks = base_ticks;
+
+	int stored_size = 0;
+	if (trace->use_compression)
+	{
+		stored_size = LZ4_compress_default((const char*)payload, (char*)data, (int)size, LZ4_compressBound(k_trace_block_size));
+	}
+	if (stored_size > 0 && stored_size < (int)size)
+	{
+		block->flags |= TRACE_BINARY_BLOCK_COMPRESSED;
+	}
+	else
+	{
+		memcpy(data, payload, size);
+		stored_size = (int)size;
+	}
+	block->stored_size = (uint32_t)stored_size;
+
+	stream->output_work[index] = fs_append(trace->fs, trace->path, block, sizeof(trace_binary_block_t) + stored_size);
+}
+
+static size_t trace_write_varint(uint8_t* buffer, uint64_t value)
+{
+	size_t size = 0;
+	while (value >= 0x80)
+	{
+		buffer[size++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buffer[size++] = (uint8_t)value;
+	return size;
+}
+
+static void trace_report_dropped(trace_t* trace)
+{
+	int64_t dropped = 0;
+	for (int i = 0; i < trace->stop_thread_count; ++i)
+	{
+		trace_thread_t* thread = atomic_load_ptr((void* volatile*)&trace->threads[i], k_atomic_acquire);
+		if (thread)
+		{
+			dropped += atomic_load64(&thread->dropped, k_atomic_relaxed) - trace->start_dropped[i];
+		}
+	}
+	if (dropped > 0)
+	{
+		debug_print(k_print_warning, "Trace capture dropped %lld events; increase the event capacity.\n", dropped);
+	}
+}
+
+static void trace_writer_printf(trace_writer_t* writer, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	if (writer->size + length + 1 > k_trace_write_buffer_size)
+	{
+		trace_writer_flush(writer);
+	}
+
+	va_start(args, format);
+	vsnprintf(writer->buffer + writer->size, k_trace_write_buffer_size - writer->size, format, args);
+	va_end(args);
+	writer->size += length;
+}
+
+static void trace_writer_append_string(trace_writer_t* writer, const char* string)
+{
+	for (const char* c = string ? string : ""; *c; ++c)
+	{
+		// Longest escape is \u00XX.
+		if (writer->size + 6 > k_trace_write_buffer_size)
+		{
+			trace_writer_flush(writer);
+		}
+		if ((unsigned char)*c < 0x20)
+		{
+			static const char k_hex[] = "0123456789abcdef";
+			memcpy(&writer->buffer[writer->size], "\\u00", 4);
+			writer->buffer[writer->size + 4] = k_hex[(*c >> 4) & 0xf];
+			writer->buffer[writer->size + 5] = k_hex[*c & 0xf];
+			writer->size += 6;
+			continue;
+		}
+		if (*c == '"' || *c == '\\')
+		{
+			writer->buffer[writer->size++] = '\\';
+		}
+		writer->buffer[writer->size++] = *c;
+	}
+}
+
+static void trace_writer_flush(trace_writer_t* writer)
+{
+	DWORD bytes_written = 0;
+	if (writer->size && !WriteFile(writer->handle, writer->buffer, (DWORD)writer->size, &bytes_written, NULL))
+	{
+		writer->failed = true;
+	}
+	writer->size = 0;
+}
+
+static double trace_ticks_to_us(uint64_t ticks)
+{
+	return (double)ticks * 1000000.0 / (double)timer_get_ticks_per_second();
+}
+
+static void trace_wait_for_writer(trace_t* trace)
+{
+	if (trace->writer)
+	{
+		thread_destroy(trace->writer);
+		trace->writer = NULL;
+	}
 }
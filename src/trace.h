@@ -1,11 +1,22 @@
 #pragma once
 
+// CPU performance tracing
+//
+// Durations and counter values are recorded per thread into a lock-free ring, so pushing
+// and popping a duration costs a TLS lookup, a timer read and a couple of stores.
+// Nothing is recorded outside a capture.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct fs_t fs_t;
 typedef struct heap_t heap_t;
 
 typedef struct trace_t trace_t;
 
 // Creates a CPU performance tracing system.
-// Event capacity is the maximum number of durations that can be traced.
+// Event capacity is the maximum number of durations each thread can record during one capture;
+// durations beyond that are dropped and counted.
 trace_t* trace_create(heap_t* heap, int event_capacity);
 
 // Destroys a CPU performance tracing system.
@@ -13,14 +24,41 @@ void trace_destroy(trace_t* trace);
 
 // Begin tracing a named duration on the current thread.
 // It is okay to nest multiple durations at once.
+// A duration must end on the thread and fiber it began on, so a job must not keep one
+// open across job_wait: it may resume on another worker. Ends that do not match are
+// ignored with a warning, and the duration is closed when the capture stops.
 void trace_duration_push(trace_t* trace, const char* name);
 
 // End tracing the currently active duration on the current thread.
 void trace_duration_pop(trace_t* trace);
 
+// Set the value of a named counter, drawn as a track of values over time.
+// Like durations, nothing is recorded outside a capture.
+void trace_counter_set(trace_t* trace, const char* name, int64_t value);
+
 // Start recording trace events.
-// A Chrome trace file will be written to path.
+// A Chrome trace file will be written to path when the capture stops.
+// Waits for the file of any previous capture to finish writing.
 void trace_capture_start(trace_t* trace, const char* path);
 
+// Format of a capture file.
+typedef enum trace_format_t
+{
+	// Chrome trace JSON, written when the capture stops.
+	k_trace_format_chrome_json,
+
+	// Compact binary stream described in trace_binary.h, written through the file system
+	// while the capture runs so long captures need no more memory than the rings.
+	// Convert it to Chrome trace JSON with ga2022_trace_convert.
+	k_trace_format_binary,
+} trace_format_t;
+
+// Start recording trace events to a file of the given format at path.
+// Binary captures are streamed through fs, with each block LZ4 compressed if use_compression is set.
+// Chrome JSON captures ignore fs and use_compression.
+void trace_capture_start_ex(trace_t* trace, const char* path, trace_format_t format, fs_t* fs, bool use_compression);
+
 // Stop recording trace events.
+// The trace file is finished on a background thread; it is complete once the next
+// capture starts or the trace is destroyed.
 void trace_capture_stop(trace_t* trace);
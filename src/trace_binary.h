@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+// Binary trace stream format
+//
+// Written by trace captures started with k_trace_format_binary and read by ga2022_trace_convert.
+// A file is a trace_binary_header_t followed by blocks, each a trace_binary_block_t
+// and its payload, optionally LZ4 compressed.
+//
+// Name blocks intern duration names: each entry is a varint id, a varint length and the
+// name's bytes. A name is always defined in the file before any block that uses it.
+//
+// Event blocks hold the events of a single thread in order. Each event is a record type byte
+// followed by the varint ticks since the previous event in the block, or since the block's
+// base ticks for the first one. Begin records are then followed by a varint name id, and
+// counter records by a varint name id and a zigzag varint value.
+
+#define TRACE_BINARY_MAGIC 0x52544147 // "GATR"
+#define TRACE_BINARY_VERSION 1
+
+typedef enum trace_binary_block_type_t
+{
+	k_trace_binary_block_names,
+	k_trace_binary_block_events,
+} trace_binary_block_type_t;
+
+typedef enum trace_binary_record_t
+{
+	k_trace_binary_record_begin,
+	k_trace_binary_record_end,
+	k_trace_binary_record_counter,
+} trace_binary_record_t;
+
+// Block payload is LZ4 compressed.
+#define TRACE_BINARY_BLOCK_COMPRESSED 0x1
+
+typedef struct trace_binary_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t ticks_per_second;
+	uint64_t start_ticks;
+	uint32_t process_id;
+	uint32_t reserved;
+} trace_binary_header_t;
+
+typedef struct trace_binary_block_t
+{
+	uint32_t type;
+	uint32_t thread_id;
+	uint32_t flags;
+	uint32_t raw_size;
+	uint32_t stored_size;
+	uint32_t reserved;
+	uint64_t base_ticks;
+} trace_binary_block_t;
@@ -0,0 +1,354 @@
+#include "debug.h"
+#include "heap.h"
+#include "trace_binary.h"
+
+#include "lz4/lz4.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+	// Largest block payload accepted; the writer produces 64KB blocks.
+	k_trace_convert_max_block_size = 16 * 1024 * 1024,
+
+	k_trace_convert_max_threads = 1024,
+
+	// Name ids past this are taken as corruption rather than grown into.
+	k_trace_convert_max_names = 16 * 1024 * 1024,
+};
+
+// Per-thread decoding state carried across blocks.
+typedef struct trace_convert_thread_t
+{
+	uint32_t thread_id;
+	int depth;
+	uint64_t last_ticks;
+} trace_convert_thread_t;
+
+typedef struct trace_convert_t
+{
+	heap_t* heap;
+	FILE* output;
+	trace_binary_header_t header;
+	bool first_event;
+
+	char** names;
+	uint32_t name_capacity;
+
+	trace_convert_thread_t threads[k_trace_convert_max_threads];
+	int thread_count;
+} trace_convert_t;
+
+static bool trace_convert_names(trace_convert_t* convert, const uint8_t* data, size_t size);
+static bool trace_convert_events(trace_convert_t* convert, const trace_binary_block_t* block, const uint8_t* data);
+static void trace_convert_write_event(trace_convert_t* convert, uint32_t thread_id, const char* phase, const char* name, uint64_t ticks);
+static void trace_convert_write_counter(trace_convert_t* convert, uint32_t thread_id, const char* name, uint64_t ticks, int64_t value);
+static void trace_convert_write_name(trace_convert_t* convert, const char* name);
+static bool trace_read_varint(const uint8_t* data, size_t size, size_t* offset, uint64_t* value);
+
+// Converts a binary trace capture into Chrome trace JSON, which chrome://tracing
+// and the Perfetto UI both open.
+// Usage: ga2022_trace_convert input.trace output.json
+int main(int argc, const char* argv[])
+{
+	debug_set_print_mask(k_print_info | k_print_warning | k_print_error);
+
+	if (argc != 3)
+	{
+		debug_print(k_print_error, "Usage: ga2022_trace_convert input.trace output.json\n");
+		return 1;
+	}
+
+	FILE* input = NULL;
+	if (fopen_s(&input, argv[1], "rb") != 0)
+	{
+		debug_print(k_print_error, "Unable to open %s\n", argv[1]);
+		return 1;
+	}
+
+	trace_convert_t convert = { .first_event = true };
+	if (fread(&convert.header, sizeof(convert.header), 1, input) != 1 ||
+		convert.header.magic != TRACE_BINARY_MAGIC ||
+		convert.header.version != TRACE_BINARY_VERSION)
+	{
+		debug_print(k_print_error, "%s is not a binary trace capture\n", argv[1]);
+		fclose(input);
+		return 1;
+	}
+
+	if (fopen_s(&convert.output, argv[2], "wb") != 0)
+	{
+		debug_print(k_print_error, "Unable to open %s\n", argv[2]);
+		fclose(input);
+		return 1;
+	}
+
+	convert.heap = heap_create(2 * 1024 * 1024);
+	uint8_t* stored = heap_alloc(convert.heap, k_trace_convert_max_block_size, 8);
+	uint8_t* raw = heap_alloc(convert.heap, k_trace_convert_max_block_size, 8);
+
+	fprintf(convert.output, "{\"displayTimeUnits\":\"ns\",\"traceEvents\":[");
+
+	bool valid = true;
+	trace_binary_block_t block;
+	while (valid && fread(&block, sizeof(block), 1, input) == 1)
+	{
+		// Uncompressed payloads are parsed in place, so both sizes must agree.
+		if (block.stored_size > k_trace_convert_max_block_size || block.raw_size > k_trace_convert_max_block_size ||
+			(!(block.flags & TRACE_BINARY_BLOCK_COMPRESSED) && block.raw_size != block.stored_size) ||
+			fread(stored, 1, block.stored_size, input) != block.stored_size)
+		{
+			valid = false;
+			break;
+		}
+
+		const uint8_t* data = stored;
+		if (block.flags & TRACE_BINARY_BLOCK_COMPRESSED)
+		{
+			int size = LZ4_decompress_safe((const char*)stored, (char*)raw, (int)block.stored_size, (int)block.raw_size);
+			if (size != (int)block.raw_size)
+			{
+				valid = false;
+				break;
+			}
+			data = raw;
+		}
+
+		switch (block.type)
+		{
+		case k_trace_binary_block_names:
+			valid = trace_convert_names(&convert, data, block.raw_size);
+			break;
+		case k_trace_binary_block_events:
+			valid = trace_convert_events(&convert, &block, data);
+			break;
+		default:
+			// Unknown blocks are skipped so newer writers stay readable.
+			break;
+		}
+	}
+
+	// Close durations cut off by a truncated capture.
+	for (int i = 0; i < convert.thread_count; ++i)
+	{
+		for (; convert.threads[i].depth > 0; --convert.threads[i].depth)
+		{
+			trace_convert_write_event(&convert, convert.threads[i].thread_id, "E", NULL, convert.threads[i].last_ticks);
+		}
+	}
+	fprintf(convert.output, "\n]}\n");
+	fclose(convert.output);
+	fclose(input);
+
+	if (!valid)
+	{
+		debug_print(k_print_warning, "%s is truncated or corrupt; converted what could be read\n", argv[1]);
+	}
+
+	for (uint32_t i = 0; i < convert.name_capacity; ++i)
+	{
+		if (convert.names[i])
+		{
+			heap_free(convert.heap, convert.names[i]);
+		}
+	}
+	if (convert.names)
+	{
+		heap_free(convert.heap, convert.names);
+	}
+	heap_free(convert.heap, raw);
+	heap_free(convert.heap, stored);
+	heap_destroy(convert.heap);
+
+	return valid ? 0 : 1;
+}
+
+static bool trace_convert_names(trace_convert_t* convert, const uint8_t* data, size_t size)
+{
+	size_t offset = 0;
+	while (offset < size)
+	{
+		uint64_t id;
+		uint64_t length;
+		if (!trace_read_varint(data, size, &offset, &id) ||
+			!trace_read_varint(data, size, &offset, &length) ||
+			length > size - offset || id >= k_trace_convert_max_names)
+		{
+			return false;
+		}
+
+		if (id >= convert->name_capacity)
+		{
+			uint32_t capacity = __max(convert->name_capacity * 2, 1024);
+			while (capacity <= id)
+			{
+				capacity *= 2;
+			}
+			char** names = heap_alloc(convert->heap, sizeof(char*) * capacity, 8);
+			memset(names, 0, sizeof(char*) * capacity);
+			if (convert->names)
+			{
+				memcpy(names, convert->names, sizeof(char*) * convert->name_capacity);
+				heap_free(convert->heap, convert->names);
+			}
+			convert->names = names;
+			convert->name_capacity = capacity;
+		}
+
+		char* name = heap_alloc(convert->heap, (size_t)length + 1, 8);
+		memcpy(name, data + offset, (size_t)length);
+		name[length] = 0;
+		if (convert->names[id])
+		{
+			heap_free(convert->heap, convert->names[id]);
+		}
+		convert->names[id] = name;
+		offset += (size_t)length;
+	}
+	return true;
+}
+
+static bool trace_convert_events(trace_convert_t* convert, const trace_binary_block_t* block, const uint8_t* data)
+{
+	trace_convert_thread_t* thread = NULL;
+	for (int i = 0; i < convert->thread_count; ++i)
+	{
+		if (convert->threads[i].thread_id == block->thread_id)
+		{
+			thread = &convert->threads[i];
+			break;
+		}
+	}
+	if (!thread)
+	{
+		if (convert->thread_count == k_trace_convert_max_threads)
+		{
+			return false;
+		}
+		thread = &convert->threads[convert->thread_count++];
+		thread->thread_id = block->thread_id;
+		thread->depth = 0;
+		thread->last_ticks = block->base_ticks;
+	}
+
+	uint64_t ticks = block->base_ticks;
+	size_t offset = 0;
+	while (offset < block->raw_size)
+	{
+		uint8_t record = data[offset++];
+		uint64_t delta;
+		if (!trace_read_varint(data, block->raw_size, &offset, &delta))
+		{
+			return false;
+		}
+		ticks += delta;
+		thread->last_ticks = ticks;
+
+		if (record == k_trace_binary_record_begin)
+		{
+			uint64_t id;
+			if (!trace_read_varint(data, block->raw_size, &offset, &id))
+			{
+				return false;
+			}
+			const char* name = id < convert->name_capacity ? convert->names[id] : NULL;
+			trace_convert_write_event(convert, thread->thread_id, "B", name ? name : "?", ticks);
+			thread->depth++;
+		}
+		else if (record == k_trace_binary_record_counter)
+		{
+			uint64_t id;
+			uint64_t value;
+			if (!trace_read_varint(data, block->raw_size, &offset, &id) ||
+				!trace_read_varint(data, block->raw_size, &offset, &value))
+			{
+				return false;
+			}
+			const char* name = id < convert->name_capacity ? convert->names[id] : NULL;
+			trace_convert_write_counter(convert, thread->thread_id, name ? name : "?", ticks, (int64_t)(value >> 1) ^ -(int64_t)(value & 1));
+		}
+		else if (record == k_trace_binary_record_end)
+		{
+			if (thread->depth > 0)
+			{
+				trace_convert_write_event(convert, thread->thread_id, "E", NULL, ticks);
+				thread->depth--;
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void trace_convert_write_event(trace_convert_t* convert, uint32_t thread_id, const char* phase, const char* name, uint64_t ticks)
+{
+	fprintf(convert->output, "%s\n{", convert->first_event ? "" : ",");
+	convert->first_event = false;
+
+	if (name)
+	{
+		trace_convert_write_name(convert, name);
+	}
+
+	uint64_t elapsed = ticks > convert->header.start_ticks ? ticks - convert->header.start_ticks : 0;
+	fprintf(convert->output, "\"ph\":\"%s\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+		phase, convert->header.process_id, thread_id,
+		(double)elapsed * 1000000.0 / (double)convert->header.ticks_per_second);
+}
+
+static void trace_convert_write_counter(trace_convert_t* convert, uint32_t thread_id, const char* name, uint64_t ticks, int64_t value)
+{
+	fprintf(convert->output, "%s\n{", convert->first_event ? "" : ",");
+	convert->first_event = false;
+
+	trace_convert_write_name(convert, name);
+
+	uint64_t elapsed = ticks > convert->header.start_ticks ? ticks - convert->header.start_ticks : 0;
+	fprintf(convert->output, "\"ph\":\"C\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%lld}}",
+		convert->header.process_id, thread_id,
+		(double)elapsed * 1000000.0 / (double)convert->header.ticks_per_second, value);
+}
+
+static void trace_convert_write_name(trace_convert_t* convert, const char* name)
+{
+	fputs("\"name\":\"", convert->output);
+	for (const char* c = name; *c; ++c)
+	{
+		if ((unsigned char)*c < 0x20)
+		{
+			fprintf(convert->output, "\\u%04x", (unsigned char)*c);
+			continue;
+		}
+		if (*c == '"' || *c == '\\')
+		{
+			fputc('\\', convert->output);
+		}
+		fputc(*c, convert->output);
+	}
+	fputs("\",", convert->output);
+}
+
+static bool trace_read_varint(const uint8_t* data, size_t size, size_t* offset, uint64_t* value)
+{
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (*offset >= size)
+		{
+			return false;
+		}
+		uint8_t byte = data[(*offset)++];
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}